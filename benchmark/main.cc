@@ -0,0 +1,472 @@
+#include "bvh-binary.h"
+#include "bvh-parser.h"
+#include "config.h"
+#include "easylogging++.h"
+
+#include <atomic>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace bf = boost::filesystem;
+
+INITIALIZE_EASYLOGGINGPP
+
+namespace {
+
+/** Number of heap allocations made by whole program */
+std::atomic<unsigned long> allocations(0);
+
+/** Measures time and heap allocations of single benchmark step */
+class Measurement {
+ public:
+  /** Constructor of Measurement object
+   *  @details  Starts measurement
+   *  @param  name  The name of measured step
+   */
+  explicit Measurement(const std::string& name)
+      : name_(name), allocations_(allocations),
+        start_(std::chrono::steady_clock::now()) {}
+
+  /** Destructor of Measurement object
+   *  @details  Stops measurement and prints its results
+   */
+  ~Measurement() {
+    auto stop = std::chrono::steady_clock::now();
+    unsigned long count = allocations - allocations_;
+    std::cout << std::left << std::setw(40) << name_ << std::right
+              << std::setw(12) << std::fixed << std::setprecision(3)
+              << std::chrono::duration<double, std::milli>(
+                 stop - start_).count() << " ms"
+              << std::setw(12) << count << " allocations" << std::endl;
+  }
+
+ private:
+  std::string name_;
+  unsigned long allocations_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+//##############################################################################
+// Parse and forward kinematics of single file
+//##############################################################################
+void benchmark_file(const bf::path& path) {
+  std::cout << "File: " << path.string() << std::endl;
+
+  bvh::Bvh_parser parser;
+  bvh::Bvh data;
+
+  {
+    Measurement measurement("parse");
+    if (parser.parse(path, &data)) {
+      std::cerr << "Cannot parse file" << std::endl;
+      std::exit(1);
+    }
+  }
+
+  std::cout << data.num_frames() << " frames, " << data.joints().size()
+            << " joints" << std::endl;
+
+  {
+    Measurement measurement("parse (streaming)");
+    bvh::Bvh streamed;
+    double sum = 0.0;
+    parser.parse(path, &streamed, [](const bvh::Bvh&) { return 0; },
+        [&](unsigned, bvh::Span<const float> channels) {
+          sum += channels[0];
+          return 0;
+        });
+  }
+
+  {
+    boost::filesystem::ifstream file(path, std::ios_base::in |
+        std::ios_base::binary);
+    std::string content((std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
+
+    bvh::Bvh from_buffer;
+    Measurement measurement("parse (memory buffer)");
+    parser.parse_buffer(content, &from_buffer);
+  }
+
+  {
+    Measurement measurement("parse (hierarchy only)");
+    bvh::Bvh hierarchy;
+    parser.set_load_mode(bvh::Bvh_parser::Load_mode::HIERARCHY_ONLY);
+    parser.parse(path, &hierarchy);
+    parser.set_load_mode(bvh::Bvh_parser::Load_mode::EAGER);
+  }
+
+  {
+    bvh::Bvh lazy;
+    parser.set_load_mode(bvh::Bvh_parser::Load_mode::LAZY);
+    {
+      Measurement measurement("parse (lazy)");
+      parser.parse(path, &lazy);
+    }
+    parser.set_load_mode(bvh::Bvh_parser::Load_mode::EAGER);
+
+    std::vector<glm::mat4> pose(lazy.joints().size());
+    Measurement measurement("calculate_pose (lazy, last frame)");
+    lazy.calculate_pose(lazy.num_frames() - 1, pose.data());
+  }
+
+  {
+    bf::path binary_path = bf::temp_directory_path() / bf::unique_path(
+        "%%%%-%%%%-%%%%.bvhb");
+    {
+      Measurement measurement("save_binary");
+      bvh::save_binary(data, binary_path);
+    }
+    {
+      Measurement measurement("load_binary");
+      bvh::Bvh binary;
+      bvh::load_binary(binary_path, &binary);
+    }
+    bf::remove(binary_path);
+  }
+
+  {
+    bf::path cache_directory = bf::temp_directory_path() / bf::unique_path();
+    bvh::Bvh_parser cached_parser;
+    cached_parser.set_cache_directory(cache_directory);
+    {
+      Measurement measurement("parse (cache miss)");
+      bvh::Bvh missed;
+      cached_parser.parse(path, &missed);
+    }
+    {
+      Measurement measurement("parse (cache hit)");
+      bvh::Bvh cached;
+      cached_parser.parse(path, &cached);
+    }
+    bf::remove_all(cache_directory);
+  }
+
+  {
+    Measurement measurement("recalculate_joints_ltm");
+    data.recalculate_joints_ltm();
+  }
+
+  {
+    Measurement measurement("recalculate_joints_ltm (simd)");
+    data.recalculate_joints_ltm(nullptr, bvh::Bvh::Fk_method::SIMD);
+  }
+
+  {
+    Measurement measurement("recalculate_joints_ltm (quaternion)");
+    data.recalculate_joints_ltm(nullptr, bvh::Bvh::Fk_method::QUATERNION);
+  }
+
+  data.set_transform_storage(bvh::Bvh::Transform_storage::AFFINE);
+  {
+    Measurement measurement("recalculate_joints_ltm (affine)");
+    data.recalculate_joints_ltm();
+  }
+
+  {
+    Measurement measurement("recalculate_joints_ltm (affine simd)");
+    data.recalculate_joints_ltm(nullptr, bvh::Bvh::Fk_method::SIMD);
+  }
+
+  data.set_transform_storage(bvh::Bvh::Transform_storage::QUATERNION);
+  {
+    Measurement measurement("recalculate_joints_ltm (quat storage)");
+    data.recalculate_joints_ltm();
+  }
+  data.set_transform_storage(bvh::Bvh::Transform_storage::MATRIX);
+
+  std::vector<glm::mat4> pose(data.joints().size());
+  {
+    Measurement measurement("calculate_pose (every frame)");
+    for (unsigned frame = 0; frame < data.num_frames(); frame++)
+      data.calculate_pose(frame, pose.data());
+  }
+
+  //############################################################################
+  // The same steps on thread pool
+  //############################################################################
+  std::shared_ptr<bvh::Thread_pool> thread_pool =
+      std::make_shared<bvh::Thread_pool>();
+  std::string threads = " (" + std::to_string(thread_pool->num_threads()) +
+      " threads)";
+
+  parser.set_thread_pool(thread_pool);
+  bvh::Bvh parallel_data;
+
+  {
+    Measurement measurement("parse" + threads);
+    parser.parse(path, &parallel_data);
+  }
+
+  parallel_data.set_thread_pool(thread_pool);
+
+  {
+    Measurement measurement("recalculate_joints_ltm" + threads);
+    parallel_data.recalculate_joints_ltm();
+  }
+
+  {
+    Measurement measurement("recalculate_joints_ltm (simd)" + threads);
+    parallel_data.recalculate_joints_ltm(nullptr, bvh::Bvh::Fk_method::SIMD);
+  }
+}
+
+//##############################################################################
+// Forward kinematics of synthetic skeleton
+//##############################################################################
+void benchmark_synthetic(unsigned num_joints, unsigned num_frames) {
+  std::cout << "Synthetic: " << num_frames << " frames, " << num_joints
+            << " joints" << std::endl;
+
+  // Root with limbs of ten joints each, added in depth-first order
+  bvh::Bvh data;
+  std::vector<std::shared_ptr<bvh::Joint>> joints;
+  for (unsigned i = 0; i < num_joints; i++) {
+    std::shared_ptr<bvh::Joint> joint = std::make_shared<bvh::Joint>();
+    std::vector<bvh::Joint::Channel> channels = {
+      bvh::Joint::Channel::ZROTATION,
+      bvh::Joint::Channel::XROTATION,
+      bvh::Joint::Channel::YROTATION
+    };
+
+    if (i == 0) {
+      channels.insert(channels.begin(), {bvh::Joint::Channel::XPOSITION,
+          bvh::Joint::Channel::YPOSITION, bvh::Joint::Channel::ZPOSITION});
+    } else {
+      joint->set_parent(joints[(i - 1) % 10 == 0 ? 0 : i - 1]);
+    }
+
+    joint->set_name("joint" + std::to_string(i));
+    joint->set_offset({1.0f, 2.0f, 3.0f});
+    joint->set_channels_order(channels);
+    joints.push_back(joint);
+    data.add_joint(joint);
+  }
+
+  data.set_root_joint(joints[0]);
+  data.set_num_frames(num_frames);
+  for (unsigned frame = 0; frame < num_frames; frame++) {
+    for (unsigned channel = 0; channel < data.num_channels(); channel++) {
+      data.motion().frame(frame)[channel] = std::fmod(frame * 0.7f +
+          channel * 13.0f, 360.0f) - 180.0f;
+    }
+  }
+
+  // Every method writes to transforms allocated here
+  data.recalculate_joints_ltm();
+
+  {
+    Measurement measurement("recalculate_joints_ltm");
+    data.recalculate_joints_ltm();
+  }
+
+  {
+    Measurement measurement("recalculate_joints_ltm (simd)");
+    data.recalculate_joints_ltm(nullptr, bvh::Bvh::Fk_method::SIMD);
+  }
+
+  {
+    Measurement measurement("recalculate_joints_ltm (quaternion)");
+    data.recalculate_joints_ltm(nullptr, bvh::Bvh::Fk_method::QUATERNION);
+  }
+}
+
+//##############################################################################
+// Parse of directory of copies of single file
+//##############################################################################
+void benchmark_batch(const bf::path& path, unsigned num_copies) {
+  std::cout << "Batch: " << num_copies << " copies of " << path.string()
+            << std::endl;
+
+  bf::path directory = bf::temp_directory_path() / bf::unique_path();
+  bf::create_directories(directory);
+  for (unsigned i = 0; i < num_copies; i++)
+    bf::copy_file(path, directory / ("copy_" + std::to_string(i) + ".bvh"));
+
+  bvh::Bvh_parser parser;
+  std::vector <bf::path> paths;
+  std::vector <bvh::Bvh> bvhs;
+  std::vector <int> errors;
+
+  {
+    Measurement measurement("parse (sequential)");
+    for (bf::directory_iterator entry(directory), end; entry != end;
+        ++entry) {
+      bvh::Bvh data;
+      parser.parse(entry->path(), &data);
+    }
+  }
+
+  {
+    Measurement measurement("parse_batch");
+    parser.parse_batch(directory, "*.bvh", paths, bvhs, errors);
+  }
+
+  parser.set_thread_pool(std::make_shared<bvh::Thread_pool>());
+  bvhs.clear();
+  {
+    Measurement measurement("parse_batch (parallel frames)");
+    parser.parse_batch(directory, "*.bvh", paths, bvhs, errors);
+  }
+
+  bf::remove_all(directory);
+}
+
+} // namespace
+
+/** Runs benchmarks on files given as arguments or on walk_01.bvh test file,
+ *  directory of its copies and synthetic skeleton */
+int main(int argc, char **argv) {
+  // Logging would dominate both time and allocations
+  el::Configurations conf;
+  conf.setGlobally(el::ConfigurationType::Enabled, "false");
+  el::Loggers::reconfigureAllLoggers(conf);
+
+  if (argc < 2) {
+    benchmark_file(bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh");
+    benchmark_batch(bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh", 256);
+    benchmark_synthetic(100, 10000);
+  } else {
+    for (int i = 1; i < argc; i++)
+      benchmark_file(argv[i]);
+  }
+
+  return 0;
+}
+
+//##############################################################################
+// Counting heap allocations
+//##############################################################################
+namespace {
+
+/** Allocates memory for replaced operator new and counts allocation
+ *  @param  size  The number of bytes to be allocated
+ *  @return  The pointer to allocated memory, nullptr if allocation failed
+ */
+void* count_allocation(std::size_t size) {
+  allocations++;
+  return std::malloc(size ? size : 1);
+}
+
+/** Releases memory of replaced operator delete
+ *  @details  Not inlined, so compiler does not pair free() with operator new
+ *            at call sites and warn about mismatched deallocation
+ *  @param  pointer  The pointer to memory to be released
+ */
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+void release_allocation(void* pointer) {
+  std::free(pointer);
+}
+
+} // namespace
+
+void* operator new(std::size_t size) {
+  if (void* pointer = count_allocation(size))
+    return pointer;
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+  if (void* pointer = count_allocation(size))
+    return pointer;
+  throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return count_allocation(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return count_allocation(size);
+}
+
+void operator delete(void* pointer) noexcept {
+  release_allocation(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+  release_allocation(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+  release_allocation(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+  release_allocation(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+  release_allocation(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+  release_allocation(pointer);
+}
+
+#ifdef __cpp_aligned_new
+void* operator new(std::size_t size, std::align_val_t alignment) {
+  allocations++;
+  std::size_t align = static_cast<std::size_t>(alignment);
+  if (void* pointer = std::aligned_alloc(align,
+      (size + align - 1) / align * align))
+    return pointer;
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+  return operator new(size, alignment);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment,
+    const std::nothrow_t&) noexcept {
+  try {
+    return operator new(size, alignment);
+  } catch (const std::bad_alloc&) {
+    return nullptr;
+  }
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment,
+    const std::nothrow_t& nothrow) noexcept {
+  return operator new(size, alignment, nothrow);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+  release_allocation(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept {
+  release_allocation(pointer);
+}
+
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept {
+  release_allocation(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t, std::align_val_t)
+    noexcept {
+  release_allocation(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t,
+    const std::nothrow_t&) noexcept {
+  release_allocation(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t,
+    const std::nothrow_t&) noexcept {
+  release_allocation(pointer);
+}
+#endif
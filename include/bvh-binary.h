@@ -0,0 +1,45 @@
+#ifndef BVH_BINARY_H
+#define BVH_BINARY_H
+
+#include "bvh.h"
+
+#include <boost/filesystem.hpp>
+#include <string>
+
+namespace bf = boost::filesystem;
+
+namespace bvh {
+
+/** Saves bvh in binary format
+ *  @details  File keeps skeleton (names, offsets, channels orders and parents
+ *            of joints), number of frames, frame time and motion matrix.
+ *            All values are little-endian, motion matrix starts at 64 byte
+ *            boundary. Lazy motion matrix is decoded whole. File also keeps
+ *            key, which identifies source of data, ex. bvh file from which
+ *            cached snapshot was made.
+ *  @param  bvh   The bvh to be saved
+ *  @param  path  The path to binary file, usually with ".bvhb" extension
+ *  @param  key   The key stored in file, as default empty
+ *  @return  0 if success, -1 otherwise
+ */
+int save_binary(const Bvh& bvh, const bf::path& path,
+    const std::string& key = std::string());
+
+/** Loads bvh saved in binary format
+ *  @details  File is memory mapped and motion matrix uses mapped memory
+ *            without copying it, so loading time depends only on number of
+ *            joints. Mapping is private, changes of motion matrix are not
+ *            written to file. Big-endian processors copy motion matrix.
+ *            Bvh is not changed if file is broken or its key does not match.
+ *  @param  path  The path to binary file
+ *  @param  bvh   The pointer to empty bvh object where loaded data will be
+ *                stored
+ *  @param  key   The key which has to be stored in file, empty key matches
+ *                any file
+ *  @return  0 if success, -1 otherwise
+ */
+int load_binary(const bf::path& path, Bvh* bvh,
+    const std::string& key = std::string());
+
+} // namespace
+#endif  // BVH_BINARY_H
@@ -2,62 +2,370 @@
 #define BVH_PARSER_H
 
 #include "bvh.h"
+#include "file-buffer.h"
 #include "joint.h"
+#include "span.h"
+#include "thread-pool.h"
+#include "tokenizer.h"
 
 #include <algorithm>
 #include <boost/filesystem.hpp>
+#include <boost/utility/string_view.hpp>
 #include <functional>
+#include <istream>
+#include <limits>
 #include <locale>
 #include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
 
 namespace bf = boost::filesystem;
 
 namespace bvh {
 
-/** Bvh Parser class that is responsible for parsing .bvh file */
+/** Bvh Parser class that is responsible for parsing .bvh file
+ *  @details  Parser keeps only options, state of every parse call is local
+ *            to that call. One parser can be used by many threads at once,
+ *            as long as its options are not changed during parsing.
+ */
 class Bvh_parser {
  public:
+  /** The result of parse_batch for file that cannot be opened, parse errors
+   *  are -1 */
+  static const int kCannotOpen = -2;
+
+  /** Callback receiving parsed hierarchy before any frame
+   *  @details  Bvh has all joints, number of frames and frame time set, but
+   *            no motion data. Returns 0 to continue parsing, positive value
+   *            stops it. Negative values are reserved for parse errors.
+   */
+  typedef std::function<int(const Bvh& bvh)> Hierarchy_callback;
+
+  /** Callback receiving motion data of single frame right after it is parsed
+   *  @details  Data is valid only during the call, frames are received in
+   *            order. Returns 0 to continue parsing, positive value stops it.
+   *            Negative values are reserved for parse errors.
+   */
+  typedef std::function<int(unsigned frame, Span<const float> data)>
+      Frame_callback;
+
+  /** A enumeration type of ways of loading motion data */
+  enum class Load_mode {
+    /** All frames parsed while parsing file */
+    EAGER,
+    /** Frames parsed when they are accessed for the first time */
+    LAZY,
+    /** No frames parsed, only hierarchy and motion header */
+    HIERARCHY_ONLY
+  };
+
   /** Parses single bvh file and stored data into bvh structure
+   *  @details  The file is memory mapped and tokenized in place, without
+   *            copying its content
    *  @param  path  The path to file to be parsed
    *  @param  bvh   The pointer to bvh object where parsed data will be stored
    *  @return  0 if success, -1 otherwise
    */
-  int parse(const bf::path& path, Bvh* bvh);
+  int parse(const bf::path& path, Bvh* bvh) const;
+
+  /** Parses single bvh file passing motion data frame by frame to callback
+   *  @details  Motion data is not stored, so memory used by parsing does not
+   *            depend on number of frames. Frames are parsed sequentially,
+   *            even if thread pool is set.
+   *  @param  path          The path to file to be parsed
+   *  @param  bvh           The pointer to bvh object where hierarchy will be
+   *                        stored, its motion matrix is left empty
+   *  @param  on_hierarchy  The callback called once after hierarchy is parsed,
+   *                        empty callback continues parsing
+   *  @param  on_frame      The callback called for every frame, empty
+   *                        callback continues parsing
+   *  @return  0 if success, -1 on parse error, or positive value returned by
+   *           callback that stopped parsing
+   */
+  int parse(const bf::path& path, Bvh* bvh,
+      const Hierarchy_callback& on_hierarchy,
+      const Frame_callback& on_frame) const;
+
+  /** Parses bvh content kept in memory and stored data into bvh structure
+   *  @details  Content is tokenized in place, without copying it. Lazy
+   *            motion matrix parses frames when they are accessed, so in
+   *            LAZY mode content is copied first and caller's memory can be
+   *            released right after parsing. Frame index and cache directory
+   *            are not used.
+   *  @param  content  The content of bvh file
+   *  @param  bvh      The pointer to bvh object where parsed data will be
+   *                   stored
+   *  @return  0 if success, -1 otherwise
+   */
+  int parse_buffer(boost::string_view content, Bvh* bvh) const;
+
+  /** Parses bvh content read from stream and stored data into bvh structure
+   *  @details  Stream is read until its end into internal buffer, so it can
+   *            be ex. std::cin. Frame index and cache directory are not used.
+   *  @param  stream  The stream with content of bvh file
+   *  @param  bvh     The pointer to bvh object where parsed data will be
+   *                  stored
+   *  @return  0 if success, -1 otherwise
+   */
+  int parse(std::istream& stream, Bvh* bvh) const;
+
+  /** Parses many bvh files at once
+   *  @details  Files are parsed concurrently on thread pool, which balances
+   *            files of different sizes by work stealing. Thread pool set by
+   *            set_thread_pool is used, otherwise temporary pool with thread
+   *            for every hardware thread. With thread pool set frames of
+   *            large files are parsed in parallel too.
+   *  @param  paths   The paths to files to be parsed
+   *  @param  bvhs    The output parameter, here will be stored parsed files
+   *                  in order of paths
+   *  @param  errors  The output parameter, here will be stored results of
+   *                  parsing in order of paths, 0 if success, kCannotOpen
+   *                  if file cannot be opened, -1 on parse error
+   *  @return  0 if all files were parsed, -1 otherwise
+   */
+  int parse_batch(const std::vector <bf::path>& paths,
+      std::vector <Bvh>& bvhs, std::vector <int>& errors) const;
+
+  /** Parses bvh files from directory which names match pattern
+   *  @details  Pattern can contain '*' matching any characters and '?'
+   *            matching single character, ex. "*.bvh". Subdirectories are
+   *            not searched. Files are sorted by path and parsed as by
+   *            parse_batch.
+   *  @param  directory  The directory with files to be parsed
+   *  @param  pattern    The pattern of names of files to be parsed
+   *  @param  paths      The output parameter, here will be stored paths to
+   *                     found files
+   *  @param  bvhs       The output parameter, here will be stored parsed
+   *                     files in order of paths
+   *  @param  errors     The output parameter, here will be stored results of
+   *                     parsing in order of paths, 0 if success, kCannotOpen
+   *                     if file cannot be opened, -1 on parse error
+   *  @return  0 if all found files were parsed, -1 otherwise
+   */
+  int parse_batch(const bf::path& directory, const std::string& pattern,
+      std::vector <bf::path>& paths, std::vector <Bvh>& bvhs,
+      std::vector <int>& errors) const;
+
+  /** Sets the thread pool used for parsing motion data
+   *  @details  When set, frames are split into chunks at line boundaries and
+   *            chunks are parsed in parallel. Files which do not keep every
+   *            frame in separate line are parsed sequentially.
+   *  @param  arg  The thread pool to be used, nullptr disables parallel
+   *               parsing
+   */
+  void set_thread_pool(const std::shared_ptr <Thread_pool> arg) {
+    thread_pool_ = arg;
+  }
+
+  /** Sets the way of loading motion data
+   *  @details  EAGER parses all frames while parsing file. LAZY only finds
+   *            where blocks of frames begin, the file stays mapped and frames
+   *            are parsed when they are accessed for the first time. Lazy
+   *            mode reuses frame index saved next to file if it is up to
+   *            date. Indexing only counts values, so malformed motion data
+   *            that fails EAGER parse is not detected by LAZY parse, the
+   *            value that cannot be decoded and the rest of its block are
+   *            set to zero and the error is logged when block is accessed.
+   *            HIERARCHY_ONLY stops after frame time, so bvh has
+   *            joints, number of frames and frame time set, but no motion
+   *            data, and only beginning of mapped file is read from disk.
+   *            Streaming parse always parses all frames.
+   *  @param  arg  The load mode, as default EAGER
+   */
+  void set_load_mode(const Load_mode arg) { load_mode_ = arg; }
+
+  /** Sets whether frame index built in lazy mode is saved next to file
+   *  @details  Index is saved as file path with ".bvhidx" appended, so
+   *            opening the same file again does not scan motion data
+   *  @param  arg  true if index should be saved, as default false
+   */
+  void set_save_frame_index(const bool arg) { save_frame_index_ = arg; }
+
+  /** Sets the directory of binary snapshots of parsed files
+   *  @details  Snapshot is found by canonical path, size and modification
+   *            time of file, so it is used instead of parsing only if file
+   *            was not changed. These are also stored in snapshot and
+   *            compared when it is loaded, so snapshot of other file with
+   *            the same name hash is never used. Missing snapshot is saved
+   *            after successful parse, it is written under temporary name
+   *            and renamed, so parsers running at once never read it half
+   *            written. Only eager parse of whole file uses snapshots.
+   *  @param  arg  The cache directory, empty path disables cache
+   */
+  void set_cache_directory(const bf::path& arg) { cache_directory_ = arg; }
+
+  /** Sets the range of frames to be loaded
+   *  @details  Frames before the range are skipped without converting their
+   *            values and frames after it are not read at all. Loaded frames
+   *            are numbered from 0, so frame 0 of bvh is frame begin of file.
+   *            Range is clamped to frames of file. Partial loading is used
+   *            only by eager parse, other parses load everything.
+   *  @param  begin  The first frame to be loaded
+   *  @param  end    The frame one past the last frame to be loaded, as
+   *                 default all frames are loaded
+   */
+  void set_frame_range(const unsigned begin,
+      const unsigned end = std::numeric_limits<unsigned>::max()) {
+    first_frame_ = begin;
+    last_frame_ = end;
+  }
+
+  /** Sets the names of joints which channels are loaded
+   *  @details  All joints stay in hierarchy, but joints outside of the set
+   *            have no channels, so they keep their rest pose. Ancestors of
+   *            selected joints have to be selected too to calculate their
+   *            positions. Partial loading is used only by eager parse, other
+   *            parses load everything.
+   *  @param  names  The names of joints, empty to load channels of all joints
+   */
+  void set_joint_filter(const std::vector <std::string>& names) {
+    joint_filter_ = std::unordered_set<std::string>(names.begin(),
+        names.end());
+  }
 
  private:
+  /** A struct that keep state of single parse call */
+  struct Context {
+    /** The path to file that is parsed, empty when content is not a file */
+    bf::path path;
+    /** The bvh object to store parsed data */
+    Bvh* bvh = nullptr;
+    /** The content of file that is parsed */
+    std::shared_ptr <File_buffer> file;
+    /** The hierarchy callback of streaming parse, nullptr otherwise */
+    const Hierarchy_callback* on_hierarchy = nullptr;
+    /** The frame callback of streaming parse, nullptr otherwise */
+    const Frame_callback* on_frame = nullptr;
+    /** Whether file is loaded partially */
+    bool partial = false;
+    /** Column of motion matrix for every channel of file, -1 for channels
+     *  that are skipped by partial loading */
+    std::vector <int> columns;
+  };
+
+  /** Parses single bvh file with callbacks set in context
+   *  @param  context  The state of parse call with path, bvh and callbacks
+   *  @return  0 if success, kCannotOpen if file cannot be opened, -1 on parse
+   *           error, or value returned by callback
+   */
+  int parse_file(Context& context) const;
+
+  /** Parses bvh content opened in context
+   *  @param  context  The state of parse call with content, bvh and callbacks
+   *  @return  0 if success, -1 otherwise, or value returned by callback
+   */
+  int parse_content(Context& context) const;
+
   /** Parses single hierarchy in bvh file
-   *  @param  file  The input stream that is needed for reading file content
+   *  @param  context    The state of parse call
+   *  @param  tokenizer  The tokenizer that is needed for reading file content
    *  @return  0 if success, -1 otherwise
    */
-  int parse_hierarchy(std::ifstream& file);
+  int parse_hierarchy(Context& context, Tokenizer& tokenizer) const;
 
   /** Parses joint and its children in bvh file
-   *  @param  file    The input stream that is needed for reading file content
-   *  @param  parent  The pointer to parent joint
-   *  @param  parsed  The output parameter, here will be stored parsed joint
+   *  @param  context    The state of parse call
+   *  @param  tokenizer  The tokenizer that is needed for reading file content
+   *  @param  parent     The pointer to parent joint
+   *  @param  parsed     The output parameter, here will be stored parsed joint
    *  @return  0 if success, -1 otherwise
    */
-  int parse_joint(std::ifstream& file, std::shared_ptr <Joint> parent,
-      std::shared_ptr <Joint>& parsed);
+  int parse_joint(Context& context, Tokenizer& tokenizer,
+      std::shared_ptr <Joint> parent, std::shared_ptr <Joint>& parsed) const;
 
   /** Parses order of channel for single joint
-   *  @param  file    The input stream that is needed for reading file content
-   *  @param  joint   The pointer to joint that channels order will be parsed
+   *  @param  tokenizer  The tokenizer that is needed for reading file content
+   *  @param  joint      The pointer to joint that channels order will be parsed
    *  @return  0 if success, -1 otherwise
    */
-  int parse_channel_order(std::ifstream& file, std::shared_ptr <Joint> joint);
+  int parse_channel_order(Tokenizer& tokenizer,
+      std::shared_ptr <Joint> joint) const;
 
   /** Parses motion part data
-   *  @param  file    The input stream that is needed for reading file content
+   *  @param  context    The state of parse call
+   *  @param  tokenizer  The tokenizer that is needed for reading file content
+   *  @return  0 if success, -1 otherwise
+   */
+  int parse_motion(Context& context, Tokenizer& tokenizer) const;
+
+  /** Parses motion data of consecutive frames
+   *  @param  context      The state of parse call
+   *  @param  tokenizer    The tokenizer that is needed for reading file content
+   *  @param  first_frame  The number of first frame to be parsed
+   *  @param  num_frames   The number of frames to be parsed
+   *  @return  The number of successfully parsed frames
+   */
+  unsigned parse_frames(Context& context, Tokenizer& tokenizer,
+      unsigned first_frame, unsigned num_frames) const;
+
+  /** Parses motion data of consecutive frames passing them to frame callback
+   *  @param  context     The state of parse call
+   *  @param  tokenizer   The tokenizer that is needed for reading file content
+   *  @param  num_frames  The number of frames to be parsed
+   *  @return  0 if success, -1 on parse error, or value returned by callback
+   */
+  int stream_frames(Context& context, Tokenizer& tokenizer,
+      unsigned num_frames) const;
+
+  /** Parses motion data of selected frames and channels
+   *  @param  context     The state of parse call
+   *  @param  tokenizer   The tokenizer positioned at beginning of frames data
+   *  @param  first       The first frame to be parsed
+   *  @param  num_frames  The number of frames to be parsed
+   *  @return  0 if success, -1 otherwise
+   */
+  int parse_frames_partial(Context& context, Tokenizer& tokenizer,
+      unsigned first, unsigned num_frames) const;
+
+  /** Indexes motion data of all frames and makes motion matrix lazy
+   *  @param  context     The state of parse call
+   *  @param  tokenizer   The tokenizer positioned at beginning of frames data
+   *  @param  num_frames  The number of frames to be indexed
    *  @return  0 if success, -1 otherwise
    */
-  int parse_motion(std::ifstream& file);
+  int index_frames(Context& context, const Tokenizer& tokenizer,
+      unsigned num_frames) const;
+
+  /** Parses motion data of all frames on thread pool
+   *  @param  context     The state of parse call
+   *  @param  tokenizer   The tokenizer positioned at beginning of frames data
+   *  @param  num_frames  The number of frames to be parsed
+   *  @return  0 if success, -1 otherwise
+   */
+  int parse_frames_parallel(Context& context, const Tokenizer& tokenizer,
+      unsigned num_frames) const;
+
+  /** Checks whether options select only part of frames or channels
+   *  @return  true if eager parse loads file partially, false otherwise
+   */
+  bool partial_load() const {
+    return load_mode_ == Load_mode::EAGER && (first_frame_ != 0 ||
+        last_frame_ != std::numeric_limits<unsigned>::max() ||
+        !joint_filter_.empty());
+  }
+
+  /** Gets the path to binary snapshot of file in cache directory
+   *  @param  path  The path to bvh file
+   *  @param  key   The output parameter, here will be stored key of file made
+   *                of its canonical path, size and modification time
+   *  @return  The path to snapshot, empty path if file cannot be cached
+   */
+  bf::path cache_path(const bf::path& path, std::string* key) const;
+
+  /** Saves binary snapshot of parsed file in cache directory
+   *  @param  bvh         The parsed bvh
+   *  @param  cache_path  The path to snapshot
+   *  @param  key         The key of parsed file
+   */
+  void save_cache(const Bvh& bvh, const bf::path& cache_path,
+      const std::string& key) const;
 
   /** Trims the string, removes leading and trailing whitespace from it
    *  @param  s   The string, which leading and trailing whitespace will be
    *              trimmed
    */
-  inline void trim(std::string &s) {
+  static inline void trim(std::string &s) {
     s.erase( std::remove_if( s.begin(), s.end(),
         std::bind( std::isspace<char>, std::placeholders::_1,
         std::locale::classic() ) ), s.end() );
@@ -67,13 +375,28 @@ class Bvh_parser {
    *  @param  vector  The data that will be converted to string
    *  @return  The string that will be created from input data
    */
-  std::string vtos(const std::vector <float> &vector);
+  static std::string vtos(const std::vector <float> &vector);
+
+  /** The thread pool for parallel parsing, nullptr when disabled */
+  std::shared_ptr <Thread_pool> thread_pool_;
+
+  /** The way of loading motion data */
+  Load_mode load_mode_ = Load_mode::EAGER;
+
+  /** Whether frame index built in lazy mode is saved next to file */
+  bool save_frame_index_ = false;
+
+  /** The first frame to be loaded */
+  unsigned first_frame_ = 0;
+
+  /** The frame one past the last frame to be loaded */
+  unsigned last_frame_ = std::numeric_limits<unsigned>::max();
 
-  /** The path to file that was parsed previously */
-  bf::path path_;
+  /** Names of joints which channels are loaded, empty for all joints */
+  std::unordered_set <std::string> joint_filter_;
 
-  /** The bvh object to store parsed data */
-  Bvh* bvh_;
+  /** The directory of binary snapshots, empty when cache is disabled */
+  bf::path cache_directory_;
 };
 
 } // namespace
@@ -2,37 +2,133 @@
 #define BVH_H
 
 #include "joint.h"
+#include "motion.h"
+#include "skeleton.h"
+#include "span.h"
+#include "thread-pool.h"
 
 #include <memory>
 #include <vector>
 
 namespace bvh {
 
-/** Class created for storing motion data from bvh file */
+/** Class created for storing motion data from bvh file
+ *  @details  Const methods can be called from many threads at once, as long
+ *            as no thread modifies the object: getters, calculate_pose,
+ *            calculate_poses and reading joints' channel data, which decodes
+ *            frames of lazy motion matrix under synchronization. Methods that
+ *            modify object, including recalculate_joints_ltm, need exclusive
+ *            access. Bvh can be shared as std::shared_ptr<const Bvh> after
+ *            its transforms are calculated.
+ */
 class Bvh {
  public:
+  /** A enumeration type of forward kinematics calculation methods */
+  enum class Fk_method {
+    /** glm matrices calculated frame by frame */
+    MATRIX,
+    /** Several frames calculated at once with SIMD instructions */
+    SIMD,
+    /** Rotations composed as quaternions, matrices built only for storage */
+    QUATERNION
+  };
+
+  /** A enumeration type of transforms storage in joints */
+  enum class Transform_storage {
+    /** 4x4 matrices in Joint::ltm() and positions in Joint::pos() */
+    MATRIX,
+    /** 3x4 matrices in Joint::affine_ltm(), positions are their last column */
+    AFFINE,
+    /** Rotation quaternions in Joint::rotation() and positions in
+     *  Joint::pos(), matrices are built on request by
+     *  Joint::transform_matrix(). Always calculated by QUATERNION method. */
+    QUATERNION
+  };
+
   /** Constructor of Bvh object
    *  @details  Initializes local variables
    */
-  Bvh() : num_frames_(0), frame_time_(0), num_channels_(0) {}
+  Bvh() : skeleton_(std::make_shared<Skeleton>()), num_frames_(0),
+      frame_time_(0), num_channels_(0), motion_(std::make_shared<Motion>()),
+      transform_storage_(Transform_storage::MATRIX) {}
 
   /**
    * Recalculation of local transformation matrix for each frame in each joint
    *
    * Should be called to set local_transformation_matrix vectors in joints
-   * structures.
+   * structures. Joints are visited in parse order, without recursion. When
+   * thread pool is set, frames are split into ranges calculated in parallel.
+   * Results are stored as selected with set_transform_storage, quaternion
+   * storage is always calculated with QUATERNION method. Transforms are
+   * calculated for frames in motion matrix, so joints of bvh without motion
+   * data get no transforms.
    *
    * @param start_joint  A joint of which each child local transformation
    * matrix will be recalculated, as default it is NULL which will be resolved
    * to root_joint in method body
+   * @param method  A method of calculation, SIMD method uses the best
+   * instruction set of processor and matches MATRIX method within tolerance
+   * documented in fk-simd.h, QUATERNION method matches it within 1e-5 for
+   * rotation part and within 1e-5 relative to distance from origin for
+   * positions
+   */
+  void recalculate_joints_ltm(std::shared_ptr<Joint> start_joint = NULL,
+      Fk_method method = Fk_method::MATRIX);
+
+  /** Calculates local transformation matrices and positions of all joints
+   *  for single frame
+   *  @details  Nothing is stored in joints and no memory is allocated, so it
+   *            is suitable for evaluating one pose at a time, ex. during
+   *            playback. Results are the same as from recalculate_joints_ltm
+   *            with MATRIX method.
+   *  @param  frame  The frame to be calculated
+   *  @param  ltm    The output parameter, here will be stored matrices of
+   *                 joints, in order of joints(), at least joints().size()
+   *  @param  pos    The output parameter, here will be stored positions of
+   *                 joints, in order of joints(), nullptr if not needed
+   *  @return  0 if success, -1 if frame is out of range
+   */
+  int calculate_pose(unsigned frame, glm::mat4* ltm,
+      glm::vec3* pos = nullptr) const;
+
+  /** Calculates local transformation matrices and positions of all joints
+   *  for selected frames
+   *  @details  Poses are stored one after another, each in order of joints()
+   *  @param  frames  The frames to be calculated
+   *  @param  ltm     The output parameter, here will be stored matrices of
+   *                  joints, at least frames.size() * joints().size()
+   *  @param  pos     The output parameter, here will be stored positions of
+   *                  joints, the same size as ltm or nullptr if not needed
+   *  @return  0 if success, -1 if any frame is out of range
+   */
+  int calculate_poses(Span<const unsigned> frames, glm::mat4* ltm,
+      glm::vec3* pos = nullptr) const;
+
+  /** Gets the memory used by this bvh
+   *  @details  Counts motion matrix, joints with their transforms and
+   *            skeleton, ex. for keeping cached clips within memory budget
+   *  @return  The number of bytes of bvh data
    */
-  void recalculate_joints_ltm(std::shared_ptr<Joint> start_joint = NULL);
+  std::size_t memory_size() const;
 
   /** Adds joint to Bvh object
-   *  @details  Adds joint and increases number of data channels
+   *  @details  Adds joint and increases number of data channels. Joint's
+   *            channels are placed in the next columns of motion matrix, so
+   *            all joints have to be added before setting number of frames.
+   *            Joints have to be added in depth-first order, after their
+   *            parents and with name, offset and channels order already set.
+   *            Later changes of name, offset and channels order of joint
+   *            update skeleton too, but its number of channels stays fixed.
    *  @param  joint  The joint that will be added
    */
   void add_joint(const std::shared_ptr<Joint> joint) {
+    std::shared_ptr<Joint> parent = joint->parent();
+
+    joint->set_index(joints_.size());
+    joint->set_motion(motion_, num_channels_);
+    skeleton_->add_joint(*joint, parent ? static_cast<int>(parent->index()) :
+        Skeleton::kNoParent);
+    joint->set_skeleton(skeleton_);
     joints_.push_back(joint);
     num_channels_ += joint->num_channels();
   }
@@ -40,16 +136,24 @@ class Bvh {
   /** Gets the root joint
    *  @return  The root joint
    */
-  const std::shared_ptr<Joint> root_joint() const { return root_joint_; }
+  const std::shared_ptr<Joint>& root_joint() const { return root_joint_; }
 
   /** Gets all joints
    *  @return  The all joints
    */
-  const std::vector <std::shared_ptr <Joint>> joints() const {
+  const std::vector <std::shared_ptr <Joint>>& joints() const {
     return joints_;
   }
 
+  /** Gets the flat, index based joints hierarchy
+   *  @return  The skeleton with joints in the same order as joints()
+   */
+  const Skeleton& skeleton() const { return *skeleton_; }
+
   /** Gets the number of data frames
+   *  @details  It is the number of frames of file, motion matrix can keep
+   *            fewer of them, ex. none after streaming or hierarchy only
+   *            parse. Frames in motion matrix are motion().num_frames().
    *  @return  The number of frames
    */
   unsigned num_frames() const { return num_frames_; }
@@ -69,17 +173,62 @@ class Bvh {
    */
   void set_root_joint(const std::shared_ptr<Joint> arg) { root_joint_ = arg; }
 
+  /** Gets the motion data of all joints
+   *  @return  The frames x num_channels() motion matrix
+   */
+  const Motion& motion() const { return *motion_; }
+
+  /** Gets the motion data of all joints
+   *  @return  The frames x num_channels() motion matrix
+   */
+  Motion& motion() { return *motion_; }
+
   /** Sets the all joint at once
+   *  @details  Joints are added in given order as with add_joint
    *  @param  arg  The all joints to be set
    */
   void set_joints(const std::vector <std::shared_ptr <Joint>> arg) {
-    joints_ = arg;
+    joints_.clear();
+    skeleton_ = std::make_shared<Skeleton>();
+    num_channels_ = 0;
+    for (auto& joint : arg)
+      add_joint(joint);
+  }
+
+  /** Gets the storage of transforms calculated by recalculate_joints_ltm
+   *  @return  The transform storage
+   */
+  Transform_storage transform_storage() const { return transform_storage_; }
+
+  /** Sets the storage of transforms calculated by recalculate_joints_ltm
+   *  @details  Affine storage takes 48 bytes per joint and frame instead of
+   *            76 and is calculated with fewer operations. Quaternion storage
+   *            takes 28 bytes and builds no matrices.
+   *  @param  arg  The transform storage to be used
+   */
+  void set_transform_storage(const Transform_storage arg) {
+    transform_storage_ = arg;
+  }
+
+  /** Sets the thread pool used for forward kinematics
+   *  @param  arg  The thread pool to be used, nullptr disables parallel
+   *               calculation
+   */
+  void set_thread_pool(const std::shared_ptr<Thread_pool> arg) {
+    thread_pool_ = arg;
   }
 
   /** Sets the number of data frames
-   *  @param  arg  The number of frames to be set
+   *  @details  Resizes motion matrix to new number of frames, all channels
+   *            data are set to zero
+   *  @param  arg       The number of frames to be set
+   *  @param  allocate  Whether motion matrix is resized, when false it is
+   *                    left empty, ex. for frames that are only streamed
    */
-  void set_num_frames(const unsigned arg) { num_frames_ = arg; }
+  void set_num_frames(const unsigned arg, const bool allocate = true) {
+    num_frames_ = arg;
+    motion_->resize(allocate ? num_frames_ : 0, num_channels_);
+  }
 
   /** Sets the single data frame time
    *  @param  arg  The time of frame to be set
@@ -87,16 +236,73 @@ class Bvh {
   void set_frame_time(const double arg) { frame_time_ = arg; }
 
  private:
+  /** Calculates local transformation matrix and position of single joint
+   *  @details  Parent of joint has to be already calculated for these frames
+   *            and joint's transforms have to be resized to all frames
+   *  @param  joint        The index of joint
+   *  @param  first_frame  The first frame to be calculated
+   *  @param  last_frame   The frame one past the last frame to be calculated
+   */
+  void calculate_joint_ltm(unsigned joint, unsigned first_frame,
+      unsigned last_frame);
+
+  /** Calculates affine local transformation matrix of single joint
+   *  @details  Parent of joint has to be already calculated for these frames
+   *            and joint's affine transforms have to be resized to all frames
+   *  @param  joint        The index of joint
+   *  @param  first_frame  The first frame to be calculated
+   *  @param  last_frame   The frame one past the last frame to be calculated
+   */
+  void calculate_joint_affine(unsigned joint, unsigned first_frame,
+      unsigned last_frame);
+
+  /** Calculates transforms of joints range with quaternions
+   *  @details  Rotations and positions are composed down the hierarchy frame
+   *            by frame, matrices are built only for matrix storages,
+   *            quaternion storage keeps rotations and positions
+   *  @param  first_joint  The first joint to be calculated
+   *  @param  last_joint   The joint one past the last joint to be calculated
+   *  @param  first_frame  The first frame to be calculated
+   *  @param  last_frame   The frame one past the last frame to be calculated
+   */
+  void calculate_joints_quaternion(unsigned first_joint, unsigned last_joint,
+      unsigned first_frame, unsigned last_frame);
+
+  /** Calculates local transformation matrix and position of single joint
+   *  for single frame
+   *  @param  data        The joint's channels data of frame
+   *  @param  program     The program applying joint's channels
+   *  @param  channels    The joint's channels order
+   *  @param  offmat      The matrix of joint's offset
+   *  @param  parent_ltm  The parent's matrix of frame, nullptr for root
+   *  @param  ltm         The output parameter, here will be stored matrix
+   *  @param  pos         The output parameter, here will be stored position
+   */
+  static void calculate_transform(const float* data,
+      const Channel_program& program, Span<const Joint::Channel> channels,
+      const glm::mat4& offmat, const glm::mat4* parent_ltm, glm::mat4& ltm,
+      glm::vec3& pos);
+
   /** A root joint in this bvh file */
   std::shared_ptr<Joint> root_joint_;
   /** All joints in file in order of parse */
   std::vector <std::shared_ptr <Joint>> joints_;
-  /** A number of motion frames in this bvh file */
+  /** Index based hierarchy of joints_, shared with joints that keep it in
+   *  sync with their data */
+  std::shared_ptr <Skeleton> skeleton_;
+  /** A number of motion frames in this bvh file, never used as a bound of
+   *  motion matrix which can keep fewer frames */
   unsigned num_frames_;
   /** A time of single frame */
   double frame_time_;
   /** Number of channels of all joints */
   unsigned num_channels_;
+  /** Motion data of all joints */
+  std::shared_ptr <Motion> motion_;
+  /** Thread pool for parallel calculations, nullptr when disabled */
+  std::shared_ptr <Thread_pool> thread_pool_;
+  /** Storage of calculated transforms */
+  Transform_storage transform_storage_;
 };
 
 } // namespace
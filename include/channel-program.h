@@ -0,0 +1,184 @@
+#ifndef CHANNEL_PROGRAM_H
+#define CHANNEL_PROGRAM_H
+
+#include "euler.h"
+#include "joint.h"
+#include "span.h"
+
+#include <algorithm>
+#include <tuple>
+#include <utility>
+
+namespace bvh {
+
+/** Gets rotation channel of selected order
+ *  @param  order  The rotation order
+ *  @param  index  The index of rotation in order, from 0 to 2
+ *  @return  The rotation channel
+ */
+constexpr Joint::Channel euler_channel(Euler_order order, int index) {
+  return "XYZXZYYXZYZXZXYZYX"[3 * static_cast<int>(order) + index] == 'X' ?
+      Joint::Channel::XROTATION :
+      "XYZXZYYXZYZXZXYZYX"[3 * static_cast<int>(order) + index] == 'Y' ?
+      Joint::Channel::YROTATION : Joint::Channel::ZROTATION;
+}
+
+/** Channels order known at compile time, three rotations optionally after
+ *  XYZ position */
+template <Euler_order Order, bool Positions>
+struct Channel_order {
+  /** Checks whether joint's channels have this order
+   *  @param  channels  The joint's channels order
+   *  @return  true if orders are the same, false otherwise
+   */
+  static bool matches(Span<const Joint::Channel> channels) {
+    const unsigned first_rotation = Positions ? 3 : 0;
+    if (channels.size() != first_rotation + 3)
+      return false;
+
+    if (Positions && (channels[0] != Joint::Channel::XPOSITION ||
+        channels[1] != Joint::Channel::YPOSITION ||
+        channels[2] != Joint::Channel::ZPOSITION))
+      return false;
+
+    for (int i = 0; i < 3; i++) {
+      if (channels[first_rotation + i] != euler_channel(Order, i))
+        return false;
+    }
+    return true;
+  }
+
+  /** Applies channels values of single frame to transform
+   *  @param  data       The joint's channels values
+   *  @param  transform  The transform to be updated
+   */
+  template <typename Transform>
+  static void apply(const float* data, Span<const Joint::Channel>,
+      Transform& transform) {
+    if (Positions) {
+      transform.translate_x(data[0]);
+      transform.translate_y(data[1]);
+      transform.translate_z(data[2]);
+      data += 3;
+    }
+    transform.template rotate<Order>(data[0], data[1], data[2]);
+  }
+};
+
+/** Class created for applying joint's channels without branching on every
+ *  channel value
+ *  @details  Channels order of joint is matched once against orders used by
+ *            bvh exporters, each of them has its own instantiation for every
+ *            transform type. Other orders fall back to generic program that
+ *            checks every channel. Transform has to provide translate_x,
+ *            translate_y, translate_z, rotate_x, rotate_y and rotate_z
+ *            methods taking channel value and rotate<Euler_order> method
+ *            taking three rotation values.
+ */
+class Channel_program {
+ public:
+  /** Orders with specialized programs, rotations alone or after positions */
+  typedef std::tuple<
+      Channel_order<Euler_order::XYZ, false>,
+      Channel_order<Euler_order::XZY, false>,
+      Channel_order<Euler_order::YXZ, false>,
+      Channel_order<Euler_order::YZX, false>,
+      Channel_order<Euler_order::ZXY, false>,
+      Channel_order<Euler_order::ZYX, false>,
+      Channel_order<Euler_order::XYZ, true>,
+      Channel_order<Euler_order::XZY, true>,
+      Channel_order<Euler_order::YXZ, true>,
+      Channel_order<Euler_order::YZX, true>,
+      Channel_order<Euler_order::ZXY, true>,
+      Channel_order<Euler_order::ZYX, true>
+      > Known_orders;
+
+  /** Number of orders with specialized programs */
+  static const unsigned kNumKnownOrders = std::tuple_size<Known_orders>::value;
+
+  /** Constructor of Channel_program object
+   *  @details  Creates generic program
+   */
+  Channel_program() : order_(kNumKnownOrders) {}
+
+  /** Constructor of Channel_program object
+   *  @details  Selects program for channels order
+   *  @param  channels  The joint's channels order
+   */
+  explicit Channel_program(Span<const Joint::Channel> channels)
+      : order_(find_order(channels,
+          std::make_index_sequence<kNumKnownOrders>())) {}
+
+  /** Checks whether program is specialized for its channels order
+   *  @return  true if channels order is one of known orders, false otherwise
+   */
+  bool specialized() const { return order_ < kNumKnownOrders; }
+
+  /** Applies channels values of single frame to transform
+   *  @param  data       The joint's channels values
+   *  @param  channels   The joint's channels order, used by generic program
+   *  @param  transform  The transform to be updated
+   */
+  template <typename Transform>
+  void apply(const float* data, Span<const Joint::Channel> channels,
+      Transform& transform) const {
+    functions<Transform>(std::make_index_sequence<kNumKnownOrders>())[order_](
+        data, channels, transform);
+  }
+
+ private:
+  /** Applies channels values checking every channel, for unknown orders */
+  template <typename Transform>
+  static void apply_generic(const float* data,
+      Span<const Joint::Channel> channels, Transform& transform) {
+    for (int i = 0; i < channels.size(); i++) {
+      if (channels[i] == Joint::Channel::XPOSITION)
+        transform.translate_x(data[i]);
+      else if (channels[i] == Joint::Channel::YPOSITION)
+        transform.translate_y(data[i]);
+      else if (channels[i] == Joint::Channel::ZPOSITION)
+        transform.translate_z(data[i]);
+      else if (channels[i] == Joint::Channel::XROTATION)
+        transform.rotate_x(data[i]);
+      else if (channels[i] == Joint::Channel::YROTATION)
+        transform.rotate_y(data[i]);
+      else if (channels[i] == Joint::Channel::ZROTATION)
+        transform.rotate_z(data[i]);
+    }
+  }
+
+  /** Gets programs of all known orders and generic program for transform
+   *  @return  The table of programs indexed by order
+   */
+  template <typename Transform, std::size_t... Indices>
+  static auto functions(std::index_sequence<Indices...>)
+      -> void (* const*)(const float*, Span<const Joint::Channel>,
+          Transform&) {
+    typedef void (*Function)(const float*, Span<const Joint::Channel>,
+        Transform&);
+    static const Function table[] = {
+      &std::tuple_element<Indices, Known_orders>::type::template
+          apply<Transform>...,
+      &apply_generic<Transform>
+    };
+    return table;
+  }
+
+  /** Finds known order of channels
+   *  @return  The index of order, kNumKnownOrders if there is none
+   */
+  template <std::size_t... Indices>
+  static unsigned find_order(Span<const Joint::Channel> channels,
+      std::index_sequence<Indices...>) {
+    const bool matches[] = {
+      std::tuple_element<Indices, Known_orders>::type::matches(channels)...
+    };
+    return std::find(matches, matches + kNumKnownOrders, true) - matches;
+  }
+
+  /** Index of known order or kNumKnownOrders for generic program */
+  unsigned order_;
+};
+
+} // namespace
+#endif  // CHANNEL_PROGRAM_H
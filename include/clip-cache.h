@@ -0,0 +1,108 @@
+#ifndef CLIP_CACHE_H
+#define CLIP_CACHE_H
+
+#include "bvh.h"
+
+#include <boost/filesystem.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace bf = boost::filesystem;
+
+namespace bvh {
+
+/** Class that keeps parsed clips shared by many users in memory
+ *  @details  Clips are found by canonical path and modification time of
+ *            file, so changed file is loaded again. Total memory_size() of
+ *            clips is kept within budget by evicting least recently used
+ *            clips, evicted clip stays valid as long as someone uses it.
+ *            When many threads ask for the same clip at once, only one of
+ *            them loads it and the others wait for its result. All methods
+ *            are thread safe.
+ */
+class Clip_cache {
+ public:
+  /** Function loading clip into empty bvh, returns 0 if success, exception
+   *  thrown by it is treated as failure */
+  typedef std::function<int(const bf::path& path, Bvh* bvh)> Loader;
+
+  /** Constructor of Clip_cache object
+   *  @param  budget  The maximal number of bytes of cached clips
+   *  @param  loader  The function loading clips, as default clips are
+   *                  parsed by Bvh_parser with default options. Custom
+   *                  loader can ex. calculate transforms of clip.
+   */
+  explicit Clip_cache(std::size_t budget, const Loader& loader = Loader());
+
+  /** Gets the clip, loads it if it is not cached
+   *  @param  path  The path to clip file
+   *  @param  clip  The output parameter, here will be stored the clip
+   *  @return  0 if success, -1 if file cannot be found or loaded
+   */
+  int get(const bf::path& path, std::shared_ptr <const Bvh>& clip);
+
+  /** Removes all clips that are not being loaded */
+  void clear();
+
+  /** Gets the memory used by cached clips
+   *  @return  The number of bytes of cached clips
+   */
+  std::size_t memory_size() const;
+
+  /** Gets the number of cached clips, including clips being loaded
+   *  @return  The number of clips
+   */
+  unsigned num_clips() const;
+
+ private:
+  /** A struct that keep single cached clip */
+  struct Entry {
+    /** Modification time of clip file */
+    std::time_t time;
+    /** Clip, ready when loading is finished, nullptr if loading failed */
+    std::shared_future <std::shared_ptr <const Bvh>> clip;
+    /** Number of bytes of clip, 0 until clip is loaded */
+    std::size_t bytes;
+    /** Whether loading of clip is finished */
+    bool loaded;
+    /** Position of clip in recently used list */
+    std::list <std::string>::iterator lru;
+    /** Identifier distinguishing reloads of the same file */
+    std::uint64_t id;
+  };
+
+  /** Removes clip, mutex has to be locked
+   *  @param  entry  The iterator to clip
+   */
+  void remove(std::unordered_map <std::string, Entry>::iterator entry);
+
+  /** Removes least recently used clips until they fit in budget, mutex has
+   *  to be locked */
+  void evict();
+
+  /** Maximal number of bytes of cached clips */
+  const std::size_t budget_;
+  /** Function loading clips */
+  Loader loader_;
+  /** Mutex that guards all other members */
+  mutable std::mutex mutex_;
+  /** Clips by canonical path */
+  std::unordered_map <std::string, Entry> entries_;
+  /** Canonical paths of clips from most to least recently used */
+  std::list <std::string> lru_;
+  /** Number of bytes of loaded clips */
+  std::size_t used_;
+  /** Identifier of the last loaded clip */
+  std::uint64_t last_id_;
+};
+
+} // namespace
+#endif  // CLIP_CACHE_H
@@ -0,0 +1,93 @@
+#ifndef EULER_H
+#define EULER_H
+
+#include <cmath>
+#include <glm/glm.hpp>
+#include <limits>
+
+namespace bvh {
+
+/** A enumeration type of rotation orders, named by order of channels */
+enum class Euler_order {
+  XYZ,
+  XZY,
+  YXZ,
+  YZX,
+  ZXY,
+  ZYX
+};
+
+/** Calculates sine and cosine of rotation angle
+ *  @details  Values smaller than float epsilon are set to 0.0f, so rotation
+ *            matrices of right angles are exact
+ *  @param  angle  The rotation angle in degrees
+ *  @param  sin_a  The output parameter, here will be stored sine
+ *  @param  cos_a  The output parameter, here will be stored cosine
+ */
+inline void angle_sin_cos(float angle, float& sin_a, float& cos_a) {
+  float rangle = glm::radians(angle);
+  sin_a = glm::sin(rangle);
+  if (std::fabs(sin_a) < std::numeric_limits<float>::epsilon())
+    sin_a = 0.0f;
+  cos_a = glm::cos(rangle);
+  if (std::fabs(cos_a) < std::numeric_limits<float>::epsilon())
+    cos_a = 0.0f;
+}
+
+/** Creates rotation matrix of three rotations in selected order
+ *  @details  Matrix is calculated in closed form, the same as product of
+ *            three single axis rotation matrices of utils::rotation_matrix.
+ *            Adding 0.0f turns every -0.0f into 0.0f, as in that product.
+ *  @param  first   The angle of first rotation in degrees
+ *  @param  second  The angle of second rotation in degrees
+ *  @param  third   The angle of third rotation in degrees
+ *  @return  The 3x3 rotation matrix
+ */
+template <Euler_order Order>
+glm::mat3 euler_matrix(float first, float second, float third) {
+  float s0, c0, s1, c1, s2, c2;
+  angle_sin_cos(first, s0, c0);
+  angle_sin_cos(second, s1, c1);
+  angle_sin_cos(third, s2, c2);
+
+  glm::vec3 x, y, z;  // columns of matrix
+
+  switch (Order) {
+    case Euler_order::XYZ:
+      x = glm::vec3(c1 * c2, c0 * s2 + c2 * s0 * s1, s0 * s2 - c0 * c2 * s1);
+      y = glm::vec3(-c1 * s2, c0 * c2 - s0 * s1 * s2, c0 * s1 * s2 + c2 * s0);
+      z = glm::vec3(s1, -c1 * s0, c0 * c1);
+      break;
+    case Euler_order::XZY:
+      x = glm::vec3(c1 * c2, c0 * c2 * s1 + s0 * s2, c2 * s0 * s1 - c0 * s2);
+      y = glm::vec3(-s1, c0 * c1, c1 * s0);
+      z = glm::vec3(c1 * s2, c0 * s1 * s2 - c2 * s0, c0 * c2 + s0 * s1 * s2);
+      break;
+    case Euler_order::YXZ:
+      x = glm::vec3(c0 * c2 + s0 * s1 * s2, c1 * s2, c0 * s1 * s2 - c2 * s0);
+      y = glm::vec3(c2 * s0 * s1 - c0 * s2, c1 * c2, c0 * c2 * s1 + s0 * s2);
+      z = glm::vec3(c1 * s0, -s1, c0 * c1);
+      break;
+    case Euler_order::YZX:
+      x = glm::vec3(c0 * c1, s1, -c1 * s0);
+      y = glm::vec3(s0 * s2 - c0 * c2 * s1, c1 * c2, c0 * s2 + c2 * s0 * s1);
+      z = glm::vec3(c0 * s1 * s2 + c2 * s0, -c1 * s2, c0 * c2 - s0 * s1 * s2);
+      break;
+    case Euler_order::ZXY:
+      x = glm::vec3(c0 * c2 - s0 * s1 * s2, c0 * s1 * s2 + c2 * s0, -c1 * s2);
+      y = glm::vec3(-c1 * s0, c0 * c1, s1);
+      z = glm::vec3(c0 * s2 + c2 * s0 * s1, s0 * s2 - c0 * c2 * s1, c1 * c2);
+      break;
+    case Euler_order::ZYX:
+      x = glm::vec3(c0 * c1, c1 * s0, -s1);
+      y = glm::vec3(c0 * s1 * s2 - c2 * s0, c0 * c2 + s0 * s1 * s2, c1 * s2);
+      z = glm::vec3(c0 * c2 * s1 + s0 * s2, c2 * s0 * s1 - c0 * s2, c1 * c2);
+      break;
+  }
+
+  const glm::vec3 zero(0.0f);
+  return glm::mat3(x + zero, y + zero, z + zero);
+}
+
+} // namespace
+#endif  // EULER_H
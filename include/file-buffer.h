@@ -0,0 +1,79 @@
+#ifndef FILE_BUFFER_H
+#define FILE_BUFFER_H
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <cstddef>
+#include <istream>
+#include <string>
+
+namespace bf = boost::filesystem;
+
+namespace bvh {
+
+/** Class that keeps read-only content of whole file in memory
+ *  @details  Regular files are memory mapped, so their content is loaded
+ *            lazily by the operating system and never copied. Other files
+ *            (ex. pipes) and streams are read into internal buffer. Buffer
+ *            can also only view memory owned by someone else.
+ */
+class File_buffer {
+ public:
+  /** Opens file and makes its content available
+   *  @param  path  The path to file to be opened
+   *  @return  0 if success, -1 otherwise
+   */
+  int open(const bf::path& path);
+
+  /** Reads whole stream into internal buffer
+   *  @param  stream  The stream to be read until its end
+   *  @return  0 if success, -1 otherwise
+   */
+  int open(std::istream& stream);
+
+  /** Makes memory owned by caller the content, without copying it
+   *  @param  data  The pointer to first character of content
+   *  @param  size  The number of characters of content
+   */
+  void open(const char* data, std::size_t size) {
+    view_ = data;
+    view_size_ = size;
+  }
+
+  /** Copies memory owned by caller into internal buffer
+   *  @param  data  The pointer to first character of content
+   *  @param  size  The number of characters of content
+   */
+  void assign(const char* data, std::size_t size) {
+    content_.assign(data, size);
+  }
+
+  /** Gets the beginning of file content
+   *  @return  The pointer to first character of file
+   */
+  const char* data() const {
+    return mapped_file_.is_open() ? mapped_file_.data() :
+        view_ ? view_ : content_.data();
+  }
+
+  /** Gets the size of file content
+   *  @return  The number of characters in file
+   */
+  std::size_t size() const {
+    return mapped_file_.is_open() ? mapped_file_.size() :
+        view_ ? view_size_ : content_.size();
+  }
+
+ private:
+  /** The memory mapping of regular file */
+  boost::iostreams::mapped_file_source mapped_file_;
+  /** The content of file that could not be mapped */
+  std::string content_;
+  /** The content owned by caller, nullptr if content is not a view */
+  const char* view_ = nullptr;
+  /** The number of characters of content owned by caller */
+  std::size_t view_size_ = 0;
+};
+
+} // namespace
+#endif  // FILE_BUFFER_H
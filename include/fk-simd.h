@@ -0,0 +1,294 @@
+#ifndef FK_SIMD_H
+#define FK_SIMD_H
+
+#include "joint.h"
+
+namespace bvh {
+namespace simd {
+
+/** A enumeration type of instruction sets used for batched calculation */
+enum class Instruction_set {
+  SCALAR,
+  SSE,
+  AVX2
+};
+
+/** A struct that keep everything needed for calculation of single joint
+ *  @details  Only plain pointers are used, because kernels compiled for
+ *            different instruction sets must not share any inline code
+ */
+struct Joint_input {
+  /** Index of parent joint, -1 for root */
+  int parent;
+  /** Offset of joint in relation to parent */
+  float offset[3];
+  /** Column of joint's first channel in motion matrix */
+  unsigned channel_offset;
+  /** Number of joint's channels */
+  unsigned num_channels;
+  /** Order of joint's channels */
+  const Joint::Channel* channels;
+  /** Output local transformation matrices, 16 floats per frame or 12 floats
+   *  per frame for affine matrices */
+  float* ltm;
+  /** Output positions, 3 floats per frame, unused for affine matrices */
+  float* pos;
+};
+
+/** A struct that keep input of calculation of joints subtree */
+struct Input {
+  /** Data of all joints, indexed as in skeleton */
+  const Joint_input* joints;
+  /** First joint to be calculated */
+  unsigned first_joint;
+  /** Joint one past the last joint to be calculated */
+  unsigned last_joint;
+  /** Frame-major motion matrix */
+  const float* motion;
+  /** Number of channels in every frame of motion matrix */
+  unsigned num_channels;
+  /** Whether matrices are stored as 3x4 affine matrices */
+  bool affine;
+};
+
+/** Maximal number of frames calculated at once */
+const unsigned kMaxLanes = 8;
+
+/** Number of floats of scratch memory needed per joint */
+const unsigned kScratchPerJoint = 12 * kMaxLanes;
+
+/** Gets the best instruction set supported by current processor
+ *  @return  The instruction set used by calculate()
+ */
+Instruction_set instruction_set();
+
+/** Calculates local transformation matrices and positions of joints subtree
+ *  @details  Several frames of the same joint are calculated at once, one
+ *            frame per SIMD lane, with matrices kept as structure of arrays.
+ *            Results match glm based calculation within 1e-5 for rotation
+ *            part of matrices and within 1e-5 relative to distance from
+ *            origin for positions. Parent of first joint, if any, has to be
+ *            already calculated for these frames.
+ *  @param  input        The joints and motion data
+ *  @param  first_frame  The first frame to be calculated
+ *  @param  last_frame   The frame one past the last frame to be calculated
+ */
+void calculate(const Input& input, unsigned first_frame, unsigned last_frame);
+
+/** Kernel for processors with AVX2, used only by calculate()
+ *  @param  input        The joints and motion data
+ *  @param  first_frame  The first frame to be calculated
+ *  @param  last_frame   The frame one past the last frame to be calculated
+ *  @param  scratch      The memory for kScratchPerJoint floats per joint
+ */
+void calculate_avx2(const Input& input, unsigned first_frame,
+    unsigned last_frame, float* scratch);
+
+//##############################################################################
+// Kernel shared by all instruction sets
+//##############################################################################
+
+/** Calculates sine and cosine of all lanes
+ *  @details  Cephes single precision algorithm, accurate to few ulp for
+ *            arguments up to several thousands radians
+ *  @param  x      The angles in radians
+ *  @param  sin_x  The output parameter, here will be stored sines
+ *  @param  cos_x  The output parameter, here will be stored cosines
+ */
+template <typename Vec>
+void sincos(Vec x, Vec& sin_x, Vec& cos_x) {
+  const Vec zero = Vec::set1(0.0f);
+  const Vec half = Vec::set1(0.5f);
+  const Vec one = Vec::set1(1.0f);
+
+  auto negative_x = less(x, zero);
+  Vec ax = abs(x);
+
+  // Reduction to [-pi/4, pi/4] with even multiple of pi/4
+  Vec y = truncate(ax * Vec::set1(1.27323954473516f));
+  y = truncate((y + one) * half) * Vec::set1(2.0f);
+  Vec r = ((ax - y * Vec::set1(0.78515625f)) -
+      y * Vec::set1(2.4187564849853515625e-4f)) -
+      y * Vec::set1(3.77489497744594108e-8f);
+
+  // Quadrant of angle, 0 to 3
+  Vec quadrant = y * half - truncate(y * Vec::set1(0.125f)) *
+      Vec::set1(4.0f);
+
+  Vec z = r * r;
+  Vec cos_r = ((Vec::set1(2.443315711809948e-5f) * z -
+      Vec::set1(1.388731625493765e-3f)) * z +
+      Vec::set1(4.166664568298827e-2f)) * z * z - half * z + one;
+  Vec sin_r = ((Vec::set1(-1.9515295891e-4f) * z +
+      Vec::set1(8.3321608736e-3f)) * z -
+      Vec::set1(1.6666654611e-1f)) * z * r + r;
+
+  auto swap = mask_or(mask_and(less(half, quadrant),
+      less(quadrant, Vec::set1(1.5f))), less(Vec::set1(2.5f), quadrant));
+  auto negative_sin = less(Vec::set1(1.5f), quadrant);
+  auto negative_cos = mask_and(less(half, quadrant),
+      less(quadrant, Vec::set1(2.5f)));
+
+  sin_x = select(swap, cos_r, sin_r);
+  cos_x = select(swap, sin_r, cos_r);
+  sin_x = select(negative_sin, zero - sin_x, sin_x);
+  sin_x = select(negative_x, zero - sin_x, sin_x);
+  cos_x = select(negative_cos, zero - cos_x, cos_x);
+}
+
+/** Calculates frames of joints subtree with selected vector type
+ *  @param  input        The joints and motion data
+ *  @param  first_frame  The first frame to be calculated
+ *  @param  last_frame   The frame one past the last frame to be calculated
+ *  @param  scratch      The memory for kScratchPerJoint floats per joint
+ */
+template <typename Vec>
+void calculate_frames(const Input& input, unsigned first_frame,
+    unsigned last_frame, float* scratch) {
+  const unsigned lanes = Vec::kLanes;
+  const Vec zero = Vec::set1(0.0f);
+  const Vec one = Vec::set1(1.0f);
+  const Vec epsilon = Vec::set1(1.1920928955078125e-7f);
+  const Vec to_radians = Vec::set1(0.01745329251994329576923690768489f);
+
+  float values[kMaxLanes];
+  float out[12][kMaxLanes];
+
+  for (unsigned frame = first_frame; frame < last_frame; frame += lanes) {
+    unsigned count = last_frame - frame < lanes ? last_frame - frame : lanes;
+
+    for (unsigned j = input.first_joint; j < input.last_joint; j++) {
+      const Joint_input& joint = input.joints[j];
+
+      // Rotation matrix as 3 columns and translation from position channels
+      Vec rot[9] = {one, zero, zero, zero, one, zero, zero, zero, one};
+      Vec trans[3] = {zero, zero, zero};
+
+      for (unsigned c = 0; c < joint.num_channels; c++) {
+        // Missing lanes repeat the last frame and are never written
+        for (unsigned k = 0; k < lanes; k++) {
+          unsigned lane_frame = frame + (k < count ? k : count - 1);
+          values[k] = input.motion[static_cast<unsigned long>(lane_frame) *
+              input.num_channels + joint.channel_offset + c];
+        }
+        Vec value = Vec::load(values);
+
+        if (joint.channels[c] == Joint::Channel::XPOSITION) {
+          trans[0] = trans[0] + value;
+          continue;
+        } else if (joint.channels[c] == Joint::Channel::YPOSITION) {
+          trans[1] = trans[1] + value;
+          continue;
+        } else if (joint.channels[c] == Joint::Channel::ZPOSITION) {
+          trans[2] = trans[2] + value;
+          continue;
+        }
+
+        Vec s, co;
+        sincos(value * to_radians, s, co);
+        s = select(less(abs(s), epsilon), zero, s);
+        co = select(less(abs(co), epsilon), zero, co);
+        Vec ms = zero - s;
+
+        // Multiplying by rotation around single axis changes two columns
+        int a, b;
+        Vec sa, sb;
+        if (joint.channels[c] == Joint::Channel::XROTATION) {
+          a = 1; b = 2; sa = s; sb = ms;
+        } else if (joint.channels[c] == Joint::Channel::YROTATION) {
+          a = 0; b = 2; sa = ms; sb = s;
+        } else {
+          a = 0; b = 1; sa = s; sb = ms;
+        }
+
+        for (int i = 0; i < 3; i++) {
+          Vec col_a = rot[3 * a + i];
+          Vec col_b = rot[3 * b + i];
+          rot[3 * a + i] = co * col_a + sa * col_b;
+          rot[3 * b + i] = sb * col_a + co * col_b;
+        }
+      }
+
+      // Transformation of parent and offset
+      Vec world[12];
+      float* joint_scratch = scratch + (j - input.first_joint) *
+          kScratchPerJoint;
+
+      if (joint.parent < 0) {
+        for (int i = 0; i < 9; i++)
+          world[i] = rot[i];
+        for (int i = 0; i < 3; i++)
+          world[9 + i] = trans[i] + Vec::set1(joint.offset[i]);
+      } else {
+        Vec parent[12];
+        if (static_cast<unsigned>(joint.parent) >= input.first_joint) {
+          const float* parent_scratch = scratch +
+              (joint.parent - input.first_joint) * kScratchPerJoint;
+          for (int i = 0; i < 12; i++)
+            parent[i] = Vec::load(parent_scratch + i * kMaxLanes);
+        } else {
+          // Parent outside of subtree is read from its calculated matrices
+          const float* parent_ltm = input.joints[joint.parent].ltm;
+          unsigned stride = input.affine ? 12 : 16;
+          for (int i = 0; i < 12; i++) {
+            int index = input.affine ? i : i / 3 * 4 + i % 3;
+            for (unsigned k = 0; k < lanes; k++) {
+              unsigned lane_frame = frame + (k < count ? k : count - 1);
+              values[k] = parent_ltm[static_cast<unsigned long>(lane_frame) *
+                  stride + index];
+            }
+            parent[i] = Vec::load(values);
+          }
+        }
+
+        for (int i = 0; i < 3; i++) {
+          world[9 + i] = parent[i] * Vec::set1(joint.offset[0]) +
+              parent[3 + i] * Vec::set1(joint.offset[1]) +
+              parent[6 + i] * Vec::set1(joint.offset[2]) + parent[9 + i];
+        }
+
+        for (int col = 0; col < 3; col++) {
+          for (int i = 0; i < 3; i++) {
+            world[3 * col + i] = parent[i] * rot[3 * col] +
+                parent[3 + i] * rot[3 * col + 1] +
+                parent[6 + i] * rot[3 * col + 2];
+          }
+        }
+      }
+
+      for (int i = 0; i < 12; i++) {
+        world[i].store(joint_scratch + i * kMaxLanes);
+        world[i].store(out[i]);
+      }
+
+      // Scattering lanes back to matrices of separate frames
+      if (input.affine) {
+        for (unsigned k = 0; k < count; k++) {
+          float* ltm = joint.ltm + static_cast<unsigned long>(frame + k) * 12;
+          for (int i = 0; i < 12; i++)
+            ltm[i] = out[i][k];
+        }
+        continue;
+      }
+
+      for (unsigned k = 0; k < count; k++) {
+        float* ltm = joint.ltm + static_cast<unsigned long>(frame + k) * 16;
+        float* pos = joint.pos + static_cast<unsigned long>(frame + k) * 3;
+        for (int col = 0; col < 3; col++) {
+          ltm[4 * col] = out[3 * col][k];
+          ltm[4 * col + 1] = out[3 * col + 1][k];
+          ltm[4 * col + 2] = out[3 * col + 2][k];
+          ltm[4 * col + 3] = 0.0f;
+        }
+        ltm[12] = pos[0] = out[9][k];
+        ltm[13] = pos[1] = out[10][k];
+        ltm[14] = pos[2] = out[11][k];
+        ltm[15] = 1.0f;
+      }
+    }
+  }
+}
+
+} // namespace
+} // namespace
+#endif  // FK_SIMD_H
@@ -0,0 +1,123 @@
+#ifndef FRAME_INDEX_H
+#define FRAME_INDEX_H
+
+#include <boost/filesystem.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <vector>
+
+namespace bf = boost::filesystem;
+
+namespace bvh {
+
+/** Class that keeps positions of motion data of frames in bvh file content
+ *  @details  Position is kept for the first frame of every block of
+ *            kFramesPerBlock frames, so frames can be decoded block by block
+ *            without reading preceding data. Index can be saved in file next
+ *            to bvh file, it is stored in native byte order, so it is
+ *            specific to host. Index saved on processor with other byte order
+ *            is rejected when loaded and built again.
+ */
+class Frame_index {
+ public:
+  /** Number of frames in single block */
+  static const unsigned kFramesPerBlock = 64;
+
+  /** Constructor of Frame_index object
+   *  @details  Initializes local variables
+   */
+  Frame_index()
+      : file_size_(0), motion_offset_(0), num_frames_(0), num_channels_(0) {}
+
+  /** Builds index by scanning motion data
+   *  @details  Values are only split at whitespace, they are not converted,
+   *            so malformed values are not detected
+   *  @param  content        The pointer to first character of file content
+   *  @param  size           The number of characters in file content
+   *  @param  motion_offset  The position of first character after frame time
+   *  @param  num_frames     The number of frames
+   *  @param  num_channels   The number of channels in every frame
+   *  @return  0 if success, -1 if there is less values than frames need
+   */
+  int build(const char* content, std::size_t size, std::size_t motion_offset,
+      unsigned num_frames, unsigned num_channels);
+
+  /** Saves index to file
+   *  @details  Index is written under temporary name and renamed, so
+   *            parsers running at once never read it half written
+   *  @param  path       The path to index file
+   *  @param  file_time  The last modification time of indexed bvh file
+   *  @return  0 if success, -1 otherwise
+   */
+  int save(const bf::path& path, std::time_t file_time) const;
+
+  /** Loads index from file
+   *  @details  Index is loaded only if it was built for the same content,
+   *            which is checked with size and modification time of bvh file
+   *            and layout of its motion data, and saved on processor with
+   *            the same byte order
+   *  @param  path           The path to index file
+   *  @param  file_size      The number of characters in bvh file
+   *  @param  file_time      The last modification time of bvh file
+   *  @param  motion_offset  The position of first character after frame time
+   *  @param  num_frames     The number of frames
+   *  @param  num_channels   The number of channels in every frame
+   *  @return  0 if success, -1 if file is missing, broken or out of date
+   */
+  int load(const bf::path& path, std::size_t file_size, std::time_t file_time,
+      std::size_t motion_offset, unsigned num_frames, unsigned num_channels);
+
+  /** Gets the path to index file of bvh file
+   *  @param  path  The path to bvh file
+   *  @return  The path to index file, bvh file path with ".bvhidx" appended
+   */
+  static bf::path index_path(const bf::path& path) {
+    return bf::path(path.string() + ".bvhidx");
+  }
+
+  /** Gets the number of indexed frames
+   *  @return  The number of frames
+   */
+  unsigned num_frames() const { return num_frames_; }
+
+  /** Gets the number of channels in every frame
+   *  @return  The number of channels
+   */
+  unsigned num_channels() const { return num_channels_; }
+
+  /** Gets the number of blocks
+   *  @return  The number of blocks
+   */
+  unsigned num_blocks() const { return offsets_.size(); }
+
+  /** Gets the position of block's motion data
+   *  @param  block  The block for which position will be returned
+   *  @return  The position of first value of block's first frame
+   */
+  std::size_t block_begin(unsigned block) const { return offsets_[block]; }
+
+  /** Gets the end of block's motion data
+   *  @details  Last block ends with file content
+   *  @param  block  The block for which end will be returned
+   *  @return  The position of first character after block's motion data
+   */
+  std::size_t block_end(unsigned block) const {
+    return block + 1 < offsets_.size() ? offsets_[block + 1] : file_size_;
+  }
+
+ private:
+  /** Number of characters in indexed file content */
+  std::size_t file_size_;
+  /** Position of first character after frame time */
+  std::size_t motion_offset_;
+  /** Number of indexed frames */
+  unsigned num_frames_;
+  /** Number of channels in every frame */
+  unsigned num_channels_;
+  /** Position of first value of every block */
+  std::vector <std::uint64_t> offsets_;
+};
+
+} // namespace
+#endif  // FRAME_INDEX_H
@@ -1,13 +1,21 @@
 #ifndef JOINT_H
 #define JOINT_H
 
+#include "motion.h"
+#include "span.h"
+
+#include <algorithm>
+#include <cstddef>
 #include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
 #include <memory>
 #include <string>
 #include <vector>
 
 namespace bvh {
 
+class Skeleton;
+
 /** Class created for storing single joint data from bvh file */
 class Joint {
  public:
@@ -29,31 +37,68 @@ class Joint {
   };
 
   /** A string names for each channel */
-  const std::vector<std::string> channel_name_str = {
-    "XPOSITION",
-    "YPOSITION",
-    "ZPOSITION",
-    "ZROTATION",
-    "XROTATION",
-    "YROTATION"
-  };
+  static const std::vector<std::string> channel_name_str;
 
-  /** Adds single frame motion data
-   *  @param  data    The motion data to be added
+  /** Constructor of Joint object
+   *  @details  Initializes local variables, joint has no motion matrix until
+   *            it is added to bvh or its channel data is set
    */
+  Joint() : offset_{0.0f, 0.0f, 0.0f}, index_(0), own_motion_(true),
+      channel_offset_(0), added_frames_(0) {}
+
+  /** Adds single frame motion data after previously added frame
+   *  @deprecated  Channel data is kept in motion matrix of bvh, fill it with
+   *               set_frame_motion_data() or Motion::frame() instead
+   *  @details  Joint added to bvh writes next frame of already sized motion
+   *            matrix, frames that do not fit in it are ignored. Joint that
+   *            is not added to bvh copies its whole matrix to grow it by one
+   *            frame, so use set_channel_data() for many frames.
+   *  @param  data    The motion data to be added, num_channels() values
+   */
+  [[deprecated("use set_frame_motion_data() or Motion::frame()")]]
   void add_frame_motion_data(const std::vector <float>& data) {
-    channel_data_.push_back(data);
+    if (own_motion_) {
+      std::shared_ptr <Motion> grown = std::make_shared<Motion>();
+      grown->resize(added_frames_ + 1, num_channels());
+      for (unsigned i = 0; i < added_frames_ && i < num_motion_frames(); i++)
+        std::copy(motion_->frame(i), motion_->frame(i) + num_channels(),
+            grown->frame(i));
+      motion_ = grown;
+    }
+
+    if (added_frames_ < num_motion_frames()) {
+      std::copy(data.begin(), data.begin() + std::min<std::size_t>(
+          data.size(), num_channels()),
+          motion_->frame(added_frames_) + channel_offset_);
+    }
+    added_frames_++;
+  }
+
+  /** Sets single frame motion data in already allocated frame
+   *  @details  Frames out of motion matrix are ignored
+   *  @param  frame   The number of frame for which data will be set
+   *  @param  data    The pointer to num_channels() values to be set
+   */
+  void set_frame_motion_data(unsigned frame, const float* data) {
+    if (frame < num_motion_frames())
+      std::copy(data, data + num_channels(),
+          motion_->frame(frame) + channel_offset_);
   }
 
   /** Gets the parent joint of this joint
    *  @return  The parent joint
    */
-  std::shared_ptr <Joint> parent() const { return parent_; }
+  std::shared_ptr <Joint> parent() const { return parent_.lock(); }
+
+  /** Gets the index of this joint in bvh skeleton
+   *  @return  The joint's index in parse order
+   */
+  unsigned index() const { return index_; }
 
   /** Gets the name of this joint
    *  @return  The joint's name
    */
-  std::string name() const { return name_; }
+  const std::string& name() const { return name_; }
 
   /** Gets the offset of this joint
    *  @return  The joint's offset
@@ -63,69 +108,158 @@ class Joint {
   /** Gets the channels order of this joint
    *  @return  The joint's channels order
    */
-  std::vector <Channel> channels_order() const {
+  const std::vector <Channel>& channels_order() const {
     return channels_order_;
   }
 
   /** Gets the all children joints of this joint
    *  @return  The joint's children
    */
-  std::vector <std::shared_ptr <Joint>> children() const {
+  const std::vector <std::shared_ptr <Joint>>& children() const {
     return children_;
   }
 
-  /** Gets the channels data of this joint for all frames
+  /** Gets the copy of channels data of this joint for all frames
+   *  @details  Every call copies joint's columns of all frames out of bvh
+   *            motion matrix into new vectors, so it costs O(frames)
+   *            allocations. For reading frames use channel_data(frame) or
+   *            Motion::frame() of bvh, which do not copy.
    *  @return  The joint's channel data
    */
-  const std::vector <std::vector <float>>& channel_data() const {
-    return channel_data_;
+  std::vector <std::vector <float>> channel_data() const {
+    std::vector <std::vector <float>> data;
+    for (unsigned i = 0; i < num_motion_frames(); i++)
+      data.push_back(channel_data(i).to_vector());
+    return data;
   }
 
   /** Gets the channel data of this joint for selected frame
+   *  @details  View points into motion matrix, it is valid until matrix is
+   *            resized
    *  @param   frame   The frame for which channel data will be returned
-   *  @return  The joint's channel data for selected frame
+   *  @return  The view on joint's channel data for selected frame, empty if
+   *           frame is out of motion matrix
    */
-  const std::vector <float>& channel_data(unsigned frame) const {
-    return channel_data_[frame];
+  Span<const float> channel_data(unsigned frame) const {
+    if (frame >= num_motion_frames())
+      return Span<const float>();
+    return Span<const float>(motion_->frame(frame) + channel_offset_,
+        num_channels());
   }
 
   /** Gets the channel data of this joint for selected frame and channel
    *  @param   frame        The frame for which channel data will be returned
    *  @param   channel_num  The number of channel which data will be returned
-   *  @return  The joint's channel data for selected frame and channel
+   *  @return  The joint's channel data for selected frame and channel, 0 if
+   *           frame or channel is out of motion matrix
    */
   float channel_data(unsigned frame, unsigned channel_num) const {
-    return channel_data_[frame][channel_num];
+    if (frame >= num_motion_frames() || channel_num >= num_channels())
+      return 0.0f;
+    return motion_->frame(frame)[channel_offset_ + channel_num];
   }
 
+  /** Gets the column of this joint's first channel in bvh motion matrix
+   *  @return  The joint's channel offset
+   */
+  unsigned channel_offset() const { return channel_offset_; }
+
   /** Gets the local transformation matrix for this joint for all frames
+   *  @details  Filled only when bvh uses matrix transform storage, empty
+   *            otherwise
    *  @return  The joint's local transformation matrix
    */
-  std::vector <glm::mat4> ltm() const {
+  const std::vector <glm::mat4>& ltm() const {
     return ltm_;
   }
 
   /** Gets the local transformation matrix for this joint for selected frame
+   *  @details  Works with every transform storage, as transform_matrix()
    *  @param   frame    The frame for which ltm will be returned
    *  @return  The joint's local transformation matrix for selected frame
    */
   glm::mat4 ltm(unsigned frame) const {
-    return ltm_[frame];
+    return transform_matrix(frame);
   }
 
   /** Gets the position for this joint for all frames
+   *  @details  Filled only when bvh uses matrix or quaternion transform
+   *            storage, empty otherwise
    *  @return  The joint's position
    */
-  std::vector <glm::vec3> pos() const {
+  const std::vector <glm::vec3>& pos() const {
     return pos_;
   }
 
   /** Gets the position for this joint for selected frame
-   *  @param   frame    The frame for which ltm will be returned
+   *  @details  Works with every transform storage, as position()
+   *  @param   frame    The frame for which position will be returned
    *  @return  The joint's position for selected frame
    */
   glm::vec3 pos(unsigned frame) const {
-    return pos_[frame];
+    return position(frame);
+  }
+
+  /** Gets the affine local transformation matrices for all frames
+   *  @details  Filled only when bvh uses affine transform storage
+   *  @return  The joint's 3x4 local transformation matrices
+   */
+  const std::vector <glm::mat4x3>& affine_ltm() const {
+    return affine_ltm_;
+  }
+
+  /** Gets the affine local transformation matrix for selected frame
+   *  @param   frame    The frame for which matrix will be returned
+   *  @return  The joint's 3x4 local transformation matrix for selected frame
+   */
+  const glm::mat4x3& affine_ltm(unsigned frame) const {
+    return affine_ltm_[frame];
+  }
+
+  /** Gets the rotations for this joint for all frames
+   *  @details  Filled only when bvh uses quaternion transform storage
+   *  @return  The joint's rotation quaternions
+   */
+  const std::vector <glm::quat>& rotation() const {
+    return rotation_;
+  }
+
+  /** Gets the rotation for this joint for selected frame
+   *  @details  Filled only when bvh uses quaternion transform storage
+   *  @param   frame    The frame for which rotation will be returned
+   *  @return  The joint's rotation quaternion for selected frame
+   */
+  const glm::quat& rotation(unsigned frame) const {
+    return rotation_[frame];
+  }
+
+  /** Gets the position for this joint for selected frame from any storage
+   *  @details  With affine storage position is the translation column
+   *  @param   frame    The frame for which position will be returned
+   *  @return  The joint's position for selected frame
+   */
+  glm::vec3 position(unsigned frame) const {
+    return affine_ltm_.empty() ? pos_[frame] : affine_ltm_[frame][3];
+  }
+
+  /** Builds local transformation matrix for selected frame from any storage
+   *  @details  With quaternion storage matrix is built from rotation and
+   *            position, other storages return stored matrix
+   *  @param   frame    The frame for which matrix will be returned
+   *  @return  The joint's local transformation matrix for selected frame
+   */
+  glm::mat4 transform_matrix(unsigned frame) const {
+    if (!affine_ltm_.empty())
+      return glm::mat4(glm::vec4(affine_ltm_[frame][0], 0.0f),
+          glm::vec4(affine_ltm_[frame][1], 0.0f),
+          glm::vec4(affine_ltm_[frame][2], 0.0f),
+          glm::vec4(affine_ltm_[frame][3], 1.0f));
+    if (!rotation_.empty()) {
+      glm::mat3 rmat = glm::mat3_cast(rotation_[frame]);
+      return glm::mat4(glm::vec4(rmat[0], 0.0f), glm::vec4(rmat[1], 0.0f),
+          glm::vec4(rmat[2], 0.0f), glm::vec4(pos_[frame], 1.0f));
+    }
+    return ltm_[frame];
   }
 
   /** Gets the number of channels of this joint
@@ -138,22 +272,34 @@ class Joint {
    */
   void set_parent(const std::shared_ptr <Joint> arg) { parent_ = arg; }
 
+  /** Sets the this joint index in bvh skeleton
+   *  @param   arg    The index of this joint
+   */
+  void set_index(const unsigned arg) { index_ = arg; }
+
   /** Sets the this joint name
+   *  @details  Skeleton of bvh that owns this joint is updated as well
    *  @param   arg    The name of this joint
    */
-  void set_name(const std::string arg) { name_ = arg; }
+  void set_name(const std::string arg);
 
   /** Sets the this joint offset
+   *  @details  Skeleton of bvh that owns this joint is updated as well, so
+   *            next calculation of transforms uses new offset
    *  @param   arg    The offset of this joint
    */
-  void set_offset(const Offset arg) { offset_ = arg; }
+  void set_offset(const Offset arg);
 
   /** Sets the this joint channels order
+   *  @details  Skeleton of bvh that owns this joint is updated as well.
+   *            Columns of joint added to bvh are fixed in motion matrix, so
+   *            then only order can change, order with other number of
+   *            channels is rejected.
    *  @param   arg    The channels order of this joint
+   *  @return  0 if success, -1 if joint is added to bvh and order has other
+   *           number of channels
    */
-  void set_channels_order(const std::vector <Channel>& arg) {
-    channels_order_ = arg;
-  }
+  int set_channels_order(const std::vector <Channel>& arg);
 
   /** Sets the this joint children
    *  @param   arg    The children of this joint
@@ -163,34 +309,174 @@ class Joint {
   }
 
   /** Sets the this joint channels data
-   *  @param   arg    The channels data of this joint
+   *  @details  Joint that is not added to bvh resizes its own motion matrix
+   *            to all frames. Motion matrix of bvh has to be already sized,
+   *            frames that do not fit in it are ignored.
+   *  @param   arg    The channels data of this joint, num_channels() values
+   *                  for every frame
    */
   void set_channel_data(const std::vector <std::vector <float>>& arg) {
-    channel_data_ = arg;
+    if (own_motion_) {
+      if (!motion_)
+        motion_ = std::make_shared<Motion>();
+      motion_->resize(arg.size(), num_channels());
+    }
+    for (unsigned i = 0; i < arg.size() && i < num_motion_frames(); i++)
+      set_frame_motion_data(i, arg[i].data());
   }
 
+  /** Sets the motion matrix that keeps this joint channels data
+   *  @param   motion          The motion matrix of bvh that owns this joint
+   *  @param   channel_offset  The column of this joint's first channel
+   */
+  void set_motion(const std::shared_ptr <Motion> motion,
+      unsigned channel_offset) {
+    motion_ = motion;
+    own_motion_ = false;
+    channel_offset_ = channel_offset;
+    added_frames_ = 0;
+  }
+
+  /** Sets the skeleton of bvh that owns this joint
+   *  @details  Skeleton has to already contain this joint at index()
+   *  @param   arg    The skeleton to be kept in sync with this joint
+   */
+  void set_skeleton(const std::shared_ptr <Skeleton> arg) { skeleton_ = arg; }
+
   /** Sets local transformation matrix for selected frame
+   *  @details  Matrix is overwritten in place, storage grows only when frame
+   *            is out of its range, so setting the same frame again does not
+   *            add any matrix
    *  @param  matrix  The local transformation matrix to be set
    *  @param  frame   The number of frame for which you want set ltm. As
    *                  default it is set to 0.
    */
   void set_ltm(const glm::mat4 matrix, unsigned frame = 0) {
-    if (frame > 0 && frame < ltm_.size())
-      ltm_[frame] = matrix;
-    else
-      ltm_.push_back(matrix);
+    if (frame >= ltm_.size())
+      ltm_.resize(frame + 1, glm::mat4(1.0f));
+    ltm_[frame] = matrix;
   }
 
-  /** Sets local transformation matrix for selected frame
+  /** Sets position for selected frame
+   *  @details  Position is overwritten in place as in set_ltm
    *  @param  pos     The position of joint in selected frame to be set
    *  @param  frame   The number of frame for which you want set position. As
    *                  default it is set to 0.
    */
   void set_pos(const glm::vec3 pos, unsigned frame = 0) {
-    if (frame > 0 && frame < pos_.size())
-      pos_[frame] = pos;
-    else
-      pos_.push_back(pos);
+    if (frame >= pos_.size())
+      pos_.resize(frame + 1, glm::vec3(0.0f));
+    pos_[frame] = pos;
+  }
+
+  /** Resizes local transformation matrices and positions to selected number
+   *  of frames
+   *  @details  Storage keeps its memory when number of frames does not change,
+   *            affine matrices and rotations are released. New frames get
+   *            identity matrix and zero position.
+   *  @param  frames  The number of frames
+   */
+  void resize_transforms(unsigned frames) {
+    std::vector <glm::mat4x3>().swap(affine_ltm_);
+    std::vector <glm::quat>().swap(rotation_);
+    ltm_.resize(frames, glm::mat4(1.0f));
+    pos_.resize(frames, glm::vec3(0.0f));
+  }
+
+  /** Resizes affine local transformation matrices to selected number of frames
+   *  @details  Storage keeps its memory when number of frames does not change,
+   *            full matrices, rotations and positions are released. New
+   *            frames get identity matrix.
+   *  @param  frames  The number of frames
+   */
+  void resize_affine_transforms(unsigned frames) {
+    std::vector <glm::mat4>().swap(ltm_);
+    std::vector <glm::quat>().swap(rotation_);
+    std::vector <glm::vec3>().swap(pos_);
+    affine_ltm_.resize(frames, glm::mat4x3(1.0f));
+  }
+
+  /** Resizes rotations and positions to selected number of frames
+   *  @details  Storage keeps its memory when number of frames does not change,
+   *            full and affine matrices are released. New frames get
+   *            identity rotation and zero position.
+   *  @param  frames  The number of frames
+   */
+  void resize_quaternion_transforms(unsigned frames) {
+    std::vector <glm::mat4>().swap(ltm_);
+    std::vector <glm::mat4x3>().swap(affine_ltm_);
+    rotation_.resize(frames, glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+    pos_.resize(frames, glm::vec3(0.0f));
+  }
+
+  /** Sets local transformation matrix and position for selected frame
+   *  @details  Transforms have to be already resized to contain this frame
+   *  @param  frame   The number of frame for which transforms will be set
+   *  @param  matrix  The local transformation matrix to be set
+   *  @param  pos     The position of joint to be set
+   */
+  void set_transform(unsigned frame, const glm::mat4& matrix,
+      const glm::vec3& pos) {
+    ltm_[frame] = matrix;
+    pos_[frame] = pos;
+  }
+
+  /** Sets rotation and position for selected frame
+   *  @details  Quaternion transforms have to be already resized to contain
+   *            this frame
+   *  @param  frame     The number of frame for which transforms will be set
+   *  @param  rotation  The rotation quaternion to be set
+   *  @param  pos       The position of joint to be set
+   */
+  void set_rotation(unsigned frame, const glm::quat& rotation,
+      const glm::vec3& pos) {
+    rotation_[frame] = rotation;
+    pos_[frame] = pos;
+  }
+
+  /** Sets affine local transformation matrix for selected frame
+   *  @details  Affine transforms have to be already resized to contain this
+   *            frame
+   *  @param  frame   The number of frame for which matrix will be set
+   *  @param  matrix  The 3x4 local transformation matrix to be set
+   */
+  void set_affine_transform(unsigned frame, const glm::mat4x3& matrix) {
+    affine_ltm_[frame] = matrix;
+  }
+
+  /** Gets the writable affine local transformation matrices for all frames
+   *  @details  Used by batched calculation that writes matrices in place,
+   *            affine transforms have to be already resized
+   *  @return  The pointer to the first frame's matrix
+   */
+  glm::mat4x3* affine_ltm_data() { return affine_ltm_.data(); }
+
+  /** Gets the writable local transformation matrices for all frames
+   *  @details  Used by batched calculation that writes matrices in place,
+   *            transforms have to be already resized
+   *  @return  The pointer to the first frame's matrix
+   */
+  glm::mat4* ltm_data() { return ltm_.data(); }
+
+  /** Gets the writable positions for all frames
+   *  @details  Used by batched calculation that writes positions in place,
+   *            transforms have to be already resized
+   *  @return  The pointer to the first frame's position
+   */
+  glm::vec3* pos_data() { return pos_.data(); }
+
+  /** Gets the memory used by this joint
+   *  @details  Motion matrix is shared by all joints, so it is not counted
+   *  @return  The number of bytes allocated for joint's data
+   */
+  std::size_t memory_size() const {
+    return sizeof(Joint) + name_.capacity() +
+        channels_order_.capacity() * sizeof(Channel) +
+        children_.capacity() * sizeof(std::shared_ptr <Joint>) +
+        ltm_.capacity() * sizeof(glm::mat4) +
+        pos_.capacity() * sizeof(glm::vec3) +
+        rotation_.capacity() * sizeof(glm::quat) +
+        affine_ltm_.capacity() * sizeof(glm::mat4x3);
   }
 
   /** Gets channels name of this joint
@@ -207,22 +493,43 @@ class Joint {
   }
 
  private:
-  /** Parent joint in file hierarchy */
-  std::shared_ptr <Joint> parent_;
+  /** Gets the number of frames in motion matrix
+   *  @return  The number of frames, 0 if joint has no motion matrix
+   */
+  unsigned num_motion_frames() const {
+    return motion_ ? motion_->num_frames() : 0;
+  }
+
+  /** Parent joint in file hierarchy, not owned to avoid reference cycle */
+  std::weak_ptr <Joint> parent_;
   std::string name_;
   Offset offset_;
+  /** Index of joint in bvh skeleton */
+  unsigned index_;
   /** Order of joint's input channels */
   std::vector <Channel> channels_order_;
   /** Pointers to joints that are children of this in hierarchy */
   std::vector <std::shared_ptr <Joint>> children_;
-  /** Structure for keep joint's channel's data.
-   *  Each vector keep data for one channel.
-   */
-  std::vector <std::vector <float> > channel_data_;
+  /** Motion matrix of bvh that keeps joint's channel's data, nullptr until
+   *  joint is added to bvh or its channel data is set */
+  std::shared_ptr <Motion> motion_;
+  /** Whether motion matrix belongs to joint, which is not added to bvh */
+  bool own_motion_;
+  /** Skeleton of bvh that owns this joint, nullptr if it is not added */
+  std::shared_ptr <Skeleton> skeleton_;
+  /** Column of joint's first channel in motion matrix */
+  unsigned channel_offset_;
+  /** Number of frames added with add_frame_motion_data() */
+  unsigned added_frames_;
   /** Local transformation matrix for each frame */
   std::vector <glm::mat4> ltm_;
   /** Vector x, y, z of joint position for each frame */
   std::vector <glm::vec3> pos_;
+  /** Affine local transformation matrix for each frame, used instead of ltm_
+   *  and pos_ */
+  std::vector <glm::mat4x3> affine_ltm_;
+  /** Rotation for each frame, used together with pos_ instead of ltm_ */
+  std::vector <glm::quat> rotation_;
 };
 
 } // namespace
@@ -0,0 +1,142 @@
+#ifndef MOTION_H
+#define MOTION_H
+
+#include "span.h"
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+namespace bvh {
+
+class File_buffer;
+class Frame_index;
+
+/** Class created for storing motion data of all joints from bvh file
+ *  @details  Data is kept in one contiguous frame-major matrix, every frame is
+ *            a row of num_channels() values ordered as joints in parse order.
+ *            Lazy matrix decodes frames from file content block by block when
+ *            they are accessed for the first time, decoding is thread safe.
+ *            External matrix uses memory of other object, ex. memory mapped
+ *            binary file.
+ */
+class Motion {
+ public:
+  /** Constructor of Motion object
+   *  @details  Initializes local variables
+   */
+  Motion() : num_frames_(0), num_channels_(0), data_(nullptr) {}
+
+  /** Resizes the matrix, all values are set to zero
+   *  @details  Matrix stops being lazy
+   *  @param  num_frames    The number of frames (rows)
+   *  @param  num_channels  The number of channels in every frame (columns)
+   */
+  void resize(unsigned num_frames, unsigned num_channels);
+
+  /** Uses memory owned by other object as the matrix, without copying it
+   *  @details  Matrix stops being lazy
+   *  @param  data          The pointer to num_frames * num_channels values
+   *  @param  owner         The owner of memory, kept as long as matrix uses it
+   *  @param  num_frames    The number of frames (rows)
+   *  @param  num_channels  The number of channels in every frame (columns)
+   */
+  void set_external(float* data, const std::shared_ptr <void>& owner,
+      unsigned num_frames, unsigned num_channels);
+
+  /** Makes the matrix lazy, frames are decoded when they are accessed
+   *  @details  Memory of whole matrix is allocated, but it is not touched
+   *            until frames are decoded
+   *  @param  file   The file content, kept as long as matrix is lazy
+   *  @param  index  The index of motion data in file content
+   */
+  void set_lazy(const std::shared_ptr <const File_buffer>& file,
+      const std::shared_ptr <const Frame_index>& index);
+
+  /** Checks whether frames are decoded when they are accessed
+   *  @return  true if matrix is lazy, false otherwise
+   */
+  bool lazy() const { return file_ != nullptr; }
+
+  /** Decodes frames of selected range that are not decoded yet
+   *  @details  Does nothing if matrix is not lazy
+   *  @param  first_frame  The first frame to be decoded
+   *  @param  last_frame   The frame one past the last frame to be decoded
+   */
+  void load(unsigned first_frame, unsigned last_frame) const {
+    if (file_)
+      load_blocks(first_frame, last_frame);
+  }
+
+  /** Gets the number of frames
+   *  @return  The number of frames
+   */
+  unsigned num_frames() const { return num_frames_; }
+
+  /** Gets the number of channels in every frame
+   *  @return  The number of channels
+   */
+  unsigned num_channels() const { return num_channels_; }
+
+  /** Gets the data of selected frame
+   *  @param  frame  The frame for which data will be returned
+   *  @return  The pointer to num_channels() values of selected frame
+   */
+  float* frame(unsigned frame) {
+    load(frame, frame + 1);
+    return data_ + static_cast<std::size_t>(frame) * num_channels_;
+  }
+
+  /** Gets the data of selected frame
+   *  @param  frame  The frame for which data will be returned
+   *  @return  The pointer to num_channels() values of selected frame
+   */
+  const float* frame(unsigned frame) const {
+    load(frame, frame + 1);
+    return data_ + static_cast<std::size_t>(frame) * num_channels_;
+  }
+
+  /** Gets the memory used by matrix
+   *  @details  Matrix in external memory is counted as well, lazy matrix is
+   *            counted whole, together with its file content
+   *  @return  The number of bytes of matrix
+   */
+  std::size_t memory_size() const;
+
+  /** Gets the whole matrix
+   *  @details  Lazy matrix decodes all frames
+   *  @return  The view on num_frames() * num_channels() values
+   */
+  Span<const float> data() const {
+    load(0, num_frames_);
+    return Span<const float>(data_,
+        static_cast<std::size_t>(num_frames_) * num_channels_);
+  }
+
+ private:
+  /** Decodes blocks of frames of lazy matrix
+   *  @param  first_frame  The first frame to be decoded
+   *  @param  last_frame   The frame one past the last frame to be decoded
+   */
+  void load_blocks(unsigned first_frame, unsigned last_frame) const;
+
+  /** A number of frames */
+  unsigned num_frames_;
+  /** A number of channels in every frame */
+  unsigned num_channels_;
+  /** Frame-major matrix of channels values, in storage_ or external memory */
+  float* data_;
+  /** Memory allocated for matrix */
+  std::unique_ptr <float[]> storage_;
+  /** Owner of external memory used as matrix, nullptr otherwise */
+  std::shared_ptr <void> owner_;
+  /** File content of lazy matrix, nullptr otherwise */
+  std::shared_ptr <const File_buffer> file_;
+  /** Index of motion data in file content of lazy matrix */
+  std::shared_ptr <const Frame_index> index_;
+  /** Flags of decoded blocks of lazy matrix */
+  std::unique_ptr <std::once_flag[]> decoded_;
+};
+
+} // namespace
+#endif  // MOTION_H
@@ -0,0 +1,195 @@
+#ifndef SKELETON_H
+#define SKELETON_H
+
+#include "channel-program.h"
+#include "joint.h"
+#include "span.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace bvh {
+
+/** Class created for storing flat, index based joints hierarchy
+ *  @details  Joints are kept in parse order, which is depth-first order, so
+ *            every parent precedes its children and subtree of every joint is
+ *            a contiguous range of indices. Children of joint are visited by
+ *            jumping over subtrees:
+ *            for (unsigned c = j + 1; c < subtree_end(j); c = subtree_end(c))
+ */
+class Skeleton {
+ public:
+  /** The parent index of root joint */
+  static const int kNoParent = -1;
+
+  /** Adds joint after all already added joints
+   *  @details  Joints have to be added in depth-first order, which means that
+   *            parent has to be the last added joint or one of its ancestors
+   *  @param  joint   The joint which data will be added
+   *  @param  parent  The index of parent joint or kNoParent for root
+   */
+  void add_joint(const Joint& joint, int parent) {
+    unsigned index = parents_.size();
+    const std::vector <Joint::Channel>& channels = joint.channels_order();
+
+    parents_.push_back(parent);
+    subtree_ends_.push_back(index + 1);
+    names_.push_back(joint.name());
+    offsets_.push_back(joint.offset());
+    channel_offsets_.push_back(channels_.size());
+    channels_.insert(channels_.end(), channels.begin(), channels.end());
+    programs_.push_back(Channel_program(channels_order(index)));
+
+    for (int ancestor = parent; ancestor != kNoParent;
+        ancestor = parents_[ancestor])
+      subtree_ends_[ancestor] = index + 1;
+  }
+
+  /** Sets the name of selected joint
+   *  @param  joint  The index of joint
+   *  @param  name   The name to be set
+   */
+  void set_name(unsigned joint, const std::string& name) {
+    names_[joint] = name;
+  }
+
+  /** Sets the offset of selected joint
+   *  @param  joint   The index of joint
+   *  @param  offset  The offset to be set
+   */
+  void set_offset(unsigned joint, const Joint::Offset& offset) {
+    offsets_[joint] = offset;
+  }
+
+  /** Sets the channels order of selected joint
+   *  @details  Number of channels cannot change, because channels of other
+   *            joints would move
+   *  @param  joint     The index of joint
+   *  @param  channels  The channels order with num_channels(joint) channels
+   */
+  void set_channels_order(unsigned joint,
+      const std::vector <Joint::Channel>& channels) {
+    std::copy(channels.begin(), channels.end(),
+        channels_.begin() + channel_offsets_[joint]);
+    programs_[joint] = Channel_program(channels_order(joint));
+  }
+
+  /** Gets the number of joints
+   *  @return  The number of joints
+   */
+  unsigned num_joints() const { return parents_.size(); }
+
+  /** Gets the total number of channels of all joints
+   *  @return  The number of channels
+   */
+  unsigned num_channels() const { return channels_.size(); }
+
+  /** Gets the parent of selected joint
+   *  @param  joint  The index of joint
+   *  @return  The index of parent joint or kNoParent for root
+   */
+  int parent(unsigned joint) const { return parents_[joint]; }
+
+  /** Gets the end of selected joint subtree
+   *  @param  joint  The index of joint
+   *  @return  The index one past the last descendant of joint
+   */
+  unsigned subtree_end(unsigned joint) const { return subtree_ends_[joint]; }
+
+  /** Gets the name of selected joint
+   *  @param  joint  The index of joint
+   *  @return  The joint's name
+   */
+  const std::string& name(unsigned joint) const { return names_[joint]; }
+
+  /** Gets the offset of selected joint
+   *  @param  joint  The index of joint
+   *  @return  The joint's offset in relation to parent
+   */
+  const Joint::Offset& offset(unsigned joint) const { return offsets_[joint]; }
+
+  /** Gets the column of selected joint's first channel in motion matrix
+   *  @param  joint  The index of joint
+   *  @return  The joint's channel offset
+   */
+  unsigned channel_offset(unsigned joint) const {
+    return channel_offsets_[joint];
+  }
+
+  /** Gets the number of channels of selected joint
+   *  @param  joint  The index of joint
+   *  @return  The joint's channels number
+   */
+  unsigned num_channels(unsigned joint) const {
+    return (joint + 1 < channel_offsets_.size() ?
+        channel_offsets_[joint + 1] : channels_.size()) -
+        channel_offsets_[joint];
+  }
+
+  /** Gets the channels order of selected joint
+   *  @param  joint  The index of joint
+   *  @return  The view on joint's channels order
+   */
+  Span<const Joint::Channel> channels_order(unsigned joint) const {
+    return Span<const Joint::Channel>(
+        channels_.data() + channel_offsets_[joint], num_channels(joint));
+  }
+
+  /** Gets the program applying channels of selected joint
+   *  @param  joint  The index of joint
+   *  @return  The program selected for joint's channels order
+   */
+  const Channel_program& program(unsigned joint) const {
+    return programs_[joint];
+  }
+
+  /** Gets the memory used by skeleton
+   *  @return  The number of bytes allocated for skeleton data
+   */
+  std::size_t memory_size() const {
+    std::size_t size = sizeof(Skeleton) +
+        parents_.capacity() * sizeof(int) +
+        subtree_ends_.capacity() * sizeof(unsigned) +
+        names_.capacity() * sizeof(std::string) +
+        offsets_.capacity() * sizeof(Joint::Offset) +
+        channel_offsets_.capacity() * sizeof(unsigned) +
+        channels_.capacity() * sizeof(Joint::Channel) +
+        programs_.capacity() * sizeof(Channel_program);
+    for (const std::string& name : names_)
+      size += name.capacity();
+    return size;
+  }
+
+  /** Finds joint with selected name
+   *  @param  name  The name of joint
+   *  @return  The index of first joint with this name, -1 if there is none
+   */
+  int find(const std::string& name) const {
+    for (unsigned i = 0; i < names_.size(); i++) {
+      if (names_[i] == name)
+        return i;
+    }
+    return -1;
+  }
+
+ private:
+  /** Index of parent of each joint */
+  std::vector <int> parents_;
+  /** Index one past the last descendant of each joint */
+  std::vector <unsigned> subtree_ends_;
+  /** Name of each joint */
+  std::vector <std::string> names_;
+  /** Offset of each joint in relation to parent */
+  std::vector <Joint::Offset> offsets_;
+  /** Index of each joint's first channel in channels_ and in motion matrix */
+  std::vector <unsigned> channel_offsets_;
+  /** Channels order of all joints, one after another */
+  std::vector <Joint::Channel> channels_;
+  /** Program applying channels of each joint */
+  std::vector <Channel_program> programs_;
+};
+
+} // namespace
+#endif  // SKELETON_H
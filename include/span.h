@@ -0,0 +1,65 @@
+#ifndef SPAN_H
+#define SPAN_H
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+namespace bvh {
+
+/** Class created for viewing contiguous sequence of values without copying
+ *  @details  The viewed values are owned by someone else, so view is valid
+ *            only as long as the owner keeps them in place
+ */
+template <typename T>
+class Span {
+ public:
+  /** Constructor of empty Span object */
+  Span() : data_(nullptr), size_(0) {}
+
+  /** Constructor of Span object
+   *  @param  data  The pointer to first viewed value
+   *  @param  size  The number of viewed values
+   */
+  Span(T* data, std::size_t size) : data_(data), size_(size) {}
+
+  /** Gets the pointer to first viewed value
+   *  @return  The pointer to viewed values
+   */
+  T* data() const { return data_; }
+
+  /** Gets the number of viewed values
+   *  @return  The number of values
+   */
+  std::size_t size() const { return size_; }
+
+  /** Checks whether there is no viewed value
+   *  @return  true if span is empty, false otherwise
+   */
+  bool empty() const { return size_ == 0; }
+
+  /** Gets the selected value
+   *  @param  index  The index of value
+   *  @return  The reference to value
+   */
+  T& operator[](std::size_t index) const { return data_[index]; }
+
+  T* begin() const { return data_; }
+  T* end() const { return data_ + size_; }
+
+  /** Copies viewed values
+   *  @return  The vector with copy of viewed values
+   */
+  std::vector <typename std::remove_const<T>::type> to_vector() const {
+    return std::vector <typename std::remove_const<T>::type>(begin(), end());
+  }
+
+ private:
+  /** First viewed value */
+  T* data_;
+  /** Number of viewed values */
+  std::size_t size_;
+};
+
+} // namespace
+#endif  // SPAN_H
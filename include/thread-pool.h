@@ -0,0 +1,93 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace bvh {
+
+/** Class that keeps set of worker threads for running independent tasks
+ *  @details  One pool can be shared by many objects and used from many
+ *            threads at once. Every worker has its own tasks queue, workers
+ *            take their own tasks from the back of queue and when it is
+ *            empty they steal tasks from the front of queues of other
+ *            workers, so uneven tasks are balanced without single shared
+ *            queue.
+ */
+class Thread_pool {
+ public:
+  /** Constructor of Thread_pool object
+   *  @details  Starts worker threads
+   *  @param  num_threads  The number of worker threads, as default it is
+   *                       number of hardware threads
+   */
+  explicit Thread_pool(unsigned num_threads = 0);
+
+  /** Destructor of Thread_pool object
+   *  @details  Waits for all queued tasks and stops worker threads
+   */
+  ~Thread_pool();
+
+  Thread_pool(const Thread_pool&) = delete;
+  Thread_pool& operator=(const Thread_pool&) = delete;
+
+  /** Runs task for every index in range [0, count) and waits for all of them
+   *  @details  Calling thread executes queued tasks while waiting, so it is
+   *            safe to call this method from inside of another task. Tasks
+   *            started by worker are queued in its own queue, tasks started
+   *            by other threads are split between all queues.
+   *  @param  count  The number of task invocations
+   *  @param  task   The task to be run, gets index of invocation
+   */
+  void parallel_for(unsigned count, const std::function<void(unsigned)>& task);
+
+  /** Gets the number of worker threads
+   *  @return  The number of worker threads
+   */
+  unsigned num_threads() const { return workers_.size(); }
+
+ private:
+  /** A struct that keep tasks queue of single worker */
+  struct Queue {
+    /** Mutex that guards tasks */
+    std::mutex mutex;
+    /** Queued tasks, owner takes them from back, others from front */
+    std::deque <std::function<void()>> tasks;
+  };
+
+  /** Takes own task of worker or steals task of other worker
+   *  @param  task  The output parameter, here will be stored taken task
+   *  @return  true if task was taken, false if all queues were empty
+   */
+  bool try_pop(std::function<void()>& task);
+
+  /** Main loop of worker thread
+   *  @param  index  The index of worker and its queue
+   */
+  void work(unsigned index);
+
+  /** Worker threads */
+  std::vector <std::thread> workers_;
+  /** Tasks queues of workers */
+  std::vector <std::unique_ptr <Queue>> queues_;
+  /** Number of queued tasks, can be negative for a while when task is
+   *  taken before it is counted */
+  std::atomic<int> pending_;
+  /** Queue from which threads that are not workers start searching */
+  std::atomic<unsigned> next_queue_;
+  /** Mutex that guards stop flag and sleeping of workers */
+  std::mutex mutex_;
+  /** Condition variable for notifying workers about new tasks */
+  std::condition_variable condition_;
+  /** Indicates whether workers should finish */
+  bool stop_;
+};
+
+} // namespace
+#endif  // THREAD_POOL_H
@@ -0,0 +1,116 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <boost/utility/string_view.hpp>
+#include <string>
+
+namespace bvh {
+
+/** Class responsible for splitting in-memory .bvh content into tokens
+ *  @details  Tokens are separated by whitespace and are returned as views on
+ *            the underlying buffer, so no token is ever copied. The buffer has
+ *            to outlive the tokenizer and all tokens returned by it.
+ */
+class Tokenizer {
+ public:
+  /** Constructor of Tokenizer object
+   *  @param  begin  The pointer to first character of content
+   *  @param  end    The pointer one past the last character of content
+   */
+  Tokenizer(const char* begin, const char* end)
+      : current_(begin), end_(end) {}
+
+  /** Reads next token
+   *  @param  token  The output parameter, here will be stored read token
+   *  @return  true if token was read, false if there is no more tokens
+   */
+  bool next(boost::string_view& token) {
+    skip_whitespace();
+    if (current_ == end_)
+      return false;
+
+    const char* begin = current_;
+    while (current_ != end_ && !is_space(*current_))
+      current_++;
+
+    token = boost::string_view(begin, current_ - begin);
+    return true;
+  }
+
+  /** Reads next token as float number
+   *  @param  number  The output parameter, here will be stored read number
+   *  @return  true if number was read, false otherwise
+   */
+  bool next(float& number);
+
+  /** Reads next token as double number
+   *  @param  number  The output parameter, here will be stored read number
+   *  @return  true if number was read, false otherwise
+   */
+  bool next(double& number);
+
+  /** Reads next token as integer number
+   *  @param  number  The output parameter, here will be stored read number
+   *  @return  true if number was read, false otherwise, also when number is
+   *           out of int range
+   */
+  bool next(int& number);
+
+  /** Converts token to float number
+   *  @details  Decimal numbers are converted by locale independent decoder,
+   *            which gives the same correctly rounded result as std::strtof
+   *  @param  token   The token to be converted
+   *  @param  number  The output parameter, here will be stored converted number
+   *  @return  true if whole token was converted, false otherwise
+   */
+  static bool to_float(boost::string_view token, float& number);
+
+  /** Converts token to double number
+   *  @param  token   The token to be converted
+   *  @param  number  The output parameter, here will be stored converted number
+   *  @return  true if whole token was converted, false otherwise
+   */
+  static bool to_double(boost::string_view token, double& number);
+
+  /** Checks whether there is any token left to read
+   *  @return  true if there is at least one more token, false otherwise
+   */
+  bool good() {
+    skip_whitespace();
+    return current_ != end_;
+  }
+
+  /** Gets the current reading position
+   *  @return  The pointer to first not yet consumed character
+   */
+  const char* position() const { return current_; }
+
+  /** Gets the end of content
+   *  @return  The pointer one past the last character of content
+   */
+  const char* end() const { return end_; }
+
+ private:
+  /** Checks whether character is whitespace in classic locale
+   *  @param  c  The character to be checked
+   *  @return  true if character is whitespace, false otherwise
+   */
+  static bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' ||
+        c == '\f';
+  }
+
+  /** Moves current position to the first not whitespace character */
+  void skip_whitespace() {
+    while (current_ != end_ && is_space(*current_))
+      current_++;
+  }
+
+  /** Current reading position */
+  const char* current_;
+  /** End of the content */
+  const char* end_;
+};
+
+} // namespace
+#endif  // TOKENIZER_H
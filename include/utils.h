@@ -1,10 +1,13 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include "euler.h"
+
 #include <cmath>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <limits>
+#include <string>
 
 namespace utils {
 
@@ -15,24 +18,29 @@ enum class Axis {
   Z
 };
 
+/** Calculates sine and cosine of angle for rotation matrices
+ *  @param  angle  The rotation angle in degrees
+ *  @param  sin_a  The output parameter, here will be stored sine
+ *  @param  cos_a  The output parameter, here will be stored cosine
+ *  @param  msin_a The output parameter, here will be stored negated sine
+ */
+inline void rotation_sin_cos(float angle, float& sin_a, float& cos_a,
+    float& msin_a) {
+  // We want to unique situation when in matrix are -0.0f, so we perform
+  // additional checking
+  bvh::angle_sin_cos(angle, sin_a, cos_a);
+  msin_a = sin_a == 0.0f ? 0.0f : (-1.0f) * sin_a;
+}
+
 /** Creates rotation matrix
  *  @param  angle  The rotation angle
  *  @param  axis   The rotation axis
  *  @return  The rotation matrix
  */
-glm::mat4 rotation_matrix(float angle, Axis axis) {
+inline glm::mat4 rotation_matrix(float angle, Axis axis) {
   glm::mat4 matrix(1.0);  // identity matrix
-  float rangle = glm::radians(angle);
-  // We want to unique situation when in matrix are -0.0f, so we perform
-  // additional checking
-  float sin_a = glm::sin(rangle);
-  if (fabs(sin_a) < std::numeric_limits<float>::epsilon())
-    sin_a = 0.0f;
-  float cos_a = glm::cos(rangle);
-  if (fabs(cos_a) < std::numeric_limits<float>::epsilon())
-    cos_a = 0.0f;
-  float msin_a = fabs(sin_a) < std::numeric_limits<float>::epsilon() ?
-      0.0f : (-1.0f) * sin_a;
+  float sin_a, cos_a, msin_a;
+  rotation_sin_cos(angle, sin_a, cos_a, msin_a);
 
   if (axis == Axis::X) {
     ((float*)glm::value_ptr(matrix))[5] = cos_a;
@@ -60,16 +68,39 @@ glm::mat4 rotation_matrix(float angle, Axis axis) {
  *  @param  axis    The rotation axis
  *  @return  The rotation matrix
  */
-glm::mat4 rotate(glm::mat4 matrix, float angle, Axis axis) {
+inline glm::mat4 rotate(glm::mat4 matrix, float angle, Axis axis) {
   return matrix * rotation_matrix(angle, axis);
 }
 
+/** Rotates 3x3 rotation matrix
+ *  @details  Only two columns depend on rotation around single axis, so
+ *            they are updated directly without full matrix multiplication
+ *  @param  matrix  The matrix to be rotated
+ *  @param  angle   The rotation angle
+ *  @param  axis    The rotation axis
+ *  @return  The rotated matrix
+ */
+inline glm::mat3 rotate(glm::mat3 matrix, float angle, Axis axis) {
+  float sin_a, cos_a, msin_a;
+  rotation_sin_cos(angle, sin_a, cos_a, msin_a);
+
+  int a = axis == Axis::X ? 1 : 0;
+  int b = axis == Axis::Z ? 1 : 2;
+  float sin_b = axis == Axis::Y ? msin_a : sin_a;
+  float msin_b = axis == Axis::Y ? sin_a : msin_a;
+  glm::vec3 column_a = matrix[a];
+
+  matrix[a] = column_a * cos_a + matrix[b] * sin_b;
+  matrix[b] = column_a * msin_b + matrix[b] * cos_a;
+  return matrix;
+}
+
 /** Translates matrix
  *  @param  matrix  The matrix to be rotated
  *  @param  translation   The translation vector
  *  @return  The translated matrix
  */
-glm::mat4 translate(glm::mat4 matrix, glm::vec3 translation) {
+inline glm::mat4 translate(glm::mat4 matrix, glm::vec3 translation) {
   ((float*)glm::value_ptr(matrix))[12] += translation.x;
   ((float*)glm::value_ptr(matrix))[13] += translation.y;
   ((float*)glm::value_ptr(matrix))[14] += translation.z;
@@ -80,7 +111,7 @@ glm::mat4 translate(glm::mat4 matrix, glm::vec3 translation) {
  *  @param  matrix  The matrix to be converted
  *  @return  The created string
  */
-std::string mat4tos(const glm::mat4& matrix) {
+inline std::string mat4tos(const glm::mat4& matrix) {
   std::string result;
   for (int i = 0; i < 4; i++) {
     for(int j = 0; j < 4; j++)
@@ -95,7 +126,7 @@ std::string mat4tos(const glm::mat4& matrix) {
  *  @param  vector  The vector to be converted
  *  @return  The created string
  */
-std::string vec3tos(const glm::vec3 &vector)
+inline std::string vec3tos(const glm::vec3 &vector)
 {
   std::string result;
   for (int i = 0; i < 3; i++) {
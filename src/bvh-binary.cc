@@ -0,0 +1,334 @@
+#include "bvh-binary.h"
+
+#include "easylogging++.h"
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <ios>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+/** Identifier at the beginning of every binary file, with format version */
+const char kMagic[8] = {'B', 'V', 'H', 'B', '0', '0', '0', '2'};
+
+/** Alignment of motion matrix in file */
+const std::size_t kMotionAlignment = 64;
+
+/** Number of bytes of joint without name and channels */
+const std::size_t kMinJointSize = 24;
+
+/** Number of channel types, channels are stored as Joint::Channel values */
+const unsigned kNumChannelTypes = 6;
+
+/** Checks whether processor stores numbers as little-endian
+ *  @return  true if processor is little-endian, false otherwise
+ */
+bool little_endian() {
+  const std::uint16_t one = 1;
+  unsigned char first;
+  std::memcpy(&first, &one, 1);
+  return first == 1;
+}
+
+/** Appends unsigned integer as little-endian bytes
+ *  @param  out    The buffer to which bytes will be appended
+ *  @param  value  The value to be appended
+ */
+template <typename T>
+void put(std::string& out, T value) {
+  for (unsigned i = 0; i < sizeof(T); i++)
+    out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+/** Appends float number as little-endian bytes
+ *  @param  out    The buffer to which bytes will be appended
+ *  @param  value  The value to be appended
+ */
+void put_float(std::string& out, float value) {
+  std::uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  put(out, bits);
+}
+
+/** Class that reads little-endian values from memory with bounds checking */
+class Reader {
+ public:
+  /** Constructor of Reader object
+   *  @param  begin  The pointer to first byte of memory
+   *  @param  end    The pointer one past the last byte of memory
+   */
+  Reader(const char* begin, const char* end) : current_(begin), end_(end) {}
+
+  /** Reads unsigned integer
+   *  @param  value  The output parameter, here will be stored read value
+   *  @return  true if value was read, false if memory ended
+   */
+  template <typename T>
+  bool get(T& value) {
+    if (static_cast<std::size_t>(end_ - current_) < sizeof(T))
+      return false;
+
+    value = 0;
+    for (unsigned i = 0; i < sizeof(T); i++) {
+      value |= static_cast<T>(static_cast<unsigned char>(current_[i])) <<
+          (8 * i);
+    }
+    current_ += sizeof(T);
+    return true;
+  }
+
+  /** Reads float number
+   *  @param  value  The output parameter, here will be stored read value
+   *  @return  true if value was read, false if memory ended
+   */
+  bool get_float(float& value) {
+    std::uint32_t bits;
+    if (!get(bits))
+      return false;
+    std::memcpy(&value, &bits, sizeof(value));
+    return true;
+  }
+
+  /** Reads bytes
+   *  @param  size   The number of bytes to be read
+   *  @param  bytes  The output parameter, here will be stored read bytes
+   *  @return  true if bytes were read, false if memory ended
+   */
+  bool get_bytes(std::size_t size, std::string& bytes) {
+    if (static_cast<std::size_t>(end_ - current_) < size)
+      return false;
+    bytes.assign(current_, size);
+    current_ += size;
+    return true;
+  }
+
+ private:
+  /** Current reading position */
+  const char* current_;
+  /** End of memory */
+  const char* end_;
+};
+
+}
+
+namespace bvh {
+
+//##############################################################################
+// Binary file save function
+//##############################################################################
+int save_binary(const Bvh& bvh, const bf::path& path,
+    const std::string& key) {
+  const Skeleton& skeleton = bvh.skeleton();
+  const Motion& motion = bvh.motion();
+  std::string header(kMagic, sizeof(kMagic));
+
+  put<std::uint32_t>(header, skeleton.num_joints());
+  put<std::uint32_t>(header, bvh.num_channels());
+  put<std::uint32_t>(header, bvh.num_frames());
+  put<std::uint32_t>(header, motion.num_frames());
+  double frame_time = bvh.frame_time();
+  std::uint64_t frame_time_bits;
+  std::memcpy(&frame_time_bits, &frame_time, sizeof(frame_time_bits));
+  put(header, frame_time_bits);
+
+  std::size_t motion_offset_position = header.size();
+  put<std::uint64_t>(header, 0);  // Motion offset, set after skeleton
+  put<std::uint32_t>(header, key.size());
+  header += key;
+
+  //############################################################################
+  // Skeleton
+  //############################################################################
+  for (unsigned joint = 0; joint < skeleton.num_joints(); joint++) {
+    const std::string& name = skeleton.name(joint);
+    Span<const Joint::Channel> channels = skeleton.channels_order(joint);
+
+    put<std::uint32_t>(header, static_cast<std::uint32_t>(
+        skeleton.parent(joint)));
+    put_float(header, skeleton.offset(joint).x);
+    put_float(header, skeleton.offset(joint).y);
+    put_float(header, skeleton.offset(joint).z);
+    put<std::uint32_t>(header, name.size());
+    header += name;
+    put<std::uint32_t>(header, channels.size());
+    for (Joint::Channel channel : channels)
+      header.push_back(static_cast<char>(channel));
+  }
+
+  header.resize((header.size() + kMotionAlignment - 1) / kMotionAlignment *
+      kMotionAlignment, '\0');
+  std::string motion_offset;
+  put<std::uint64_t>(motion_offset, header.size());
+  header.replace(motion_offset_position, motion_offset.size(), motion_offset);
+
+  //############################################################################
+  // Motion matrix
+  //############################################################################
+  bf::ofstream file(path, std::ios_base::out | std::ios_base::binary |
+      std::ios_base::trunc);
+  if (!file.is_open()) {
+    LOG(ERROR) << "Cannot open file to save : " << path;
+    return -1;
+  }
+
+  file.write(header.data(), header.size());
+
+  Span<const float> data = motion.data();
+  if (little_endian()) {
+    file.write(reinterpret_cast<const char*>(data.data()),
+        data.size() * sizeof(float));
+  } else {
+    std::string values;
+    values.reserve(data.size() * sizeof(float));
+    for (float value : data)
+      put_float(values, value);
+    file.write(values.data(), values.size());
+  }
+
+  if (!file.good()) {
+    LOG(ERROR) << "Failure while saving file : " << path;
+    return -1;
+  }
+
+  return 0;
+}
+
+//##############################################################################
+// Binary file load function
+//##############################################################################
+int load_binary(const bf::path& path, Bvh* bvh, const std::string& key) {
+  std::shared_ptr <boost::iostreams::mapped_file> mapping;
+
+  // Private mapping lets motion matrix be modified without touching file
+  try {
+    boost::iostreams::mapped_file_params params(path.string());
+    params.flags = boost::iostreams::mapped_file::priv;
+    mapping = std::make_shared<boost::iostreams::mapped_file>(params);
+  } catch (const std::exception&) {
+    LOG(ERROR) << "Cannot open file to load : " << path;
+    return -1;
+  }
+
+  Reader reader(mapping->const_data(), mapping->const_data() +
+      mapping->size());
+  std::string magic, file_key;
+  std::uint32_t num_joints = 0, num_channels = 0, num_frames = 0,
+      motion_frames = 0, key_size = 0;
+  std::uint64_t frame_time_bits = 0, motion_offset = 0;
+
+  if (!reader.get_bytes(sizeof(kMagic), magic) ||
+      magic != std::string(kMagic, sizeof(kMagic)) ||
+      !reader.get(num_joints) || !reader.get(num_channels) ||
+      !reader.get(num_frames) || !reader.get(motion_frames) ||
+      !reader.get(frame_time_bits) || !reader.get(motion_offset) ||
+      !reader.get(key_size) || !reader.get_bytes(key_size, file_key) ||
+      num_joints > mapping->size() / kMinJointSize) {
+    LOG(ERROR) << "Bad structure of binary bvh file : " << path;
+    return -1;
+  }
+
+  if (!key.empty() && key != file_key) {
+    LOG(ERROR) << "Binary bvh file was saved with other key : " << path;
+    return -1;
+  }
+
+  //############################################################################
+  // Skeleton, bvh is not changed until whole file is checked
+  //############################################################################
+  std::vector <std::shared_ptr <Joint>> joints;
+  std::vector <std::vector <std::shared_ptr <Joint>>> children(num_joints);
+  std::size_t joints_channels = 0;
+
+  for (unsigned index = 0; index < num_joints; index++) {
+    std::uint32_t parent = 0, name_size = 0, channels_size = 0;
+    Joint::Offset offset;
+    std::string name, channels;
+
+    if (!reader.get(parent) || !reader.get_float(offset.x) ||
+        !reader.get_float(offset.y) || !reader.get_float(offset.z) ||
+        !reader.get(name_size) || !reader.get_bytes(name_size, name) ||
+        !reader.get(channels_size) ||
+        !reader.get_bytes(channels_size, channels)) {
+      LOG(ERROR) << "Bad structure of binary bvh file : " << path;
+      return -1;
+    }
+
+    std::vector <Joint::Channel> channels_order;
+    for (char channel : channels) {
+      if (static_cast<unsigned char>(channel) >= kNumChannelTypes) {
+        LOG(ERROR) << "Not valid channel in binary bvh file : " << path;
+        return -1;
+      }
+      channels_order.push_back(static_cast<Joint::Channel>(channel));
+    }
+
+    std::shared_ptr <Joint> joint = std::make_shared<Joint>();
+    int parent_index = static_cast<std::int32_t>(parent);
+    if (parent_index != Skeleton::kNoParent) {
+      if (parent_index < 0 || parent_index >= static_cast<int>(index)) {
+        LOG(ERROR) << "Not valid parent of joint in binary bvh file : "
+                   << path;
+        return -1;
+      }
+      joint->set_parent(joints[parent_index]);
+      children[parent_index].push_back(joint);
+    }
+
+    joint->set_name(name);
+    joint->set_offset(offset);
+    joint->set_channels_order(channels_order);
+    joints.push_back(joint);
+    joints_channels += channels_order.size();
+  }
+
+  std::size_t motion_size = static_cast<std::size_t>(motion_frames) *
+      num_channels * sizeof(float);
+
+  if (num_channels != joints_channels ||
+      motion_offset % sizeof(float) != 0 || motion_offset > mapping->size() ||
+      mapping->size() - motion_offset < motion_size) {
+    LOG(ERROR) << "Bad structure of binary bvh file : " << path;
+    return -1;
+  }
+
+  for (unsigned index = 0; index < num_joints; index++) {
+    joints[index]->set_children(children[index]);
+    bvh->add_joint(joints[index]);
+  }
+
+  if (!joints.empty())
+    bvh->set_root_joint(joints[0]);
+
+  //############################################################################
+  // Motion matrix
+  //############################################################################
+  double frame_time;
+  std::memcpy(&frame_time, &frame_time_bits, sizeof(frame_time));
+  bvh->set_frame_time(frame_time);
+  bvh->set_num_frames(num_frames, false);
+
+  float* data = reinterpret_cast<float*>(mapping->data() + motion_offset);
+
+  if (little_endian()) {
+    bvh->motion().set_external(data, mapping, motion_frames, num_channels);
+  } else {
+    Motion& motion = bvh->motion();
+    motion.resize(motion_frames, num_channels);
+    Reader values(mapping->const_data() + motion_offset,
+        mapping->const_data() + motion_offset + motion_size);
+    for (unsigned frame = 0; frame < motion_frames; frame++) {
+      for (unsigned channel = 0; channel < num_channels; channel++)
+        values.get_float(motion.frame(frame)[channel]);
+    }
+  }
+
+  return 0;
+}
+
+} // namespace
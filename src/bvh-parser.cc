@@ -1,10 +1,17 @@
 #include "bvh-parser.h"
 
+#include "bvh-binary.h"
 #include "easylogging++.h"
+#include "file-buffer.h"
+#include "frame-index.h"
 
+#include <atomic>
 #include <boost/filesystem.hpp>
-#include <boost/filesystem/fstream.hpp>
-#include <ios>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iterator>
 #include <sstream>
 #include <string>
 
@@ -35,6 +42,94 @@ const std::string kXrot = "Xrotation";
 const std::string kYrot = "Yrotation";
 const std::string kZrot = "Zrotation";
 
+/** Minimal number of frames for which motion data is parsed in parallel */
+const unsigned kMinParallelFrames = 256;
+
+/** Number of motion data chunks per thread, more chunks balance load better */
+const unsigned kChunksPerThread = 4;
+
+/** Calculates 64-bit FNV-1a hash of text, the same on every platform
+ *  @param  text  The text to be hashed
+ *  @return  The hash of text
+ */
+std::uint64_t fnv1a_hash(const std::string& text) {
+  std::uint64_t hash = 14695981039346656037ull;
+  for (char c : text) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+/** Converts value returned by callback that stopped parsing to result of
+ *  parse
+ *  @param  ret  The not zero value returned by callback
+ *  @return  The value of callback, 1 if callback returned negative value that
+ *           is reserved for parse errors
+ */
+int callback_result(int ret) {
+  if (ret < 0) {
+    LOG(WARNING) << "Parsing callback returned reserved value " << ret
+                 << ", returning 1 instead";
+    return 1;
+  }
+  return ret;
+}
+
+/** Checks whether name matches wildcard pattern
+ *  @param  pattern  The pattern, '*' matches any characters and '?' matches
+ *                   single character
+ *  @param  name     The name to be checked
+ *  @return  true if whole name matches pattern, false otherwise
+ */
+bool match_wildcard(const std::string& pattern, const std::string& name) {
+  std::size_t p = 0, n = 0;
+  std::size_t star = std::string::npos, star_n = 0;
+
+  while (n < name.size()) {
+    if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+      p++;
+      n++;
+    } else if (p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      star_n = n;
+    } else if (star != std::string::npos) {
+      // Last star takes one more character
+      p = star + 1;
+      n = ++star_n;
+    } else {
+      return false;
+    }
+  }
+
+  while (p < pattern.size() && pattern[p] == '*')
+    p++;
+  return p == pattern.size();
+}
+
+/** Counts lines that contain anything else than whitespace
+ *  @param  begin  The pointer to first character of text
+ *  @param  end    The pointer one past the last character of text
+ *  @return  The number of not empty lines
+ */
+unsigned count_lines(const char* begin, const char* end) {
+  unsigned lines = 0;
+
+  while (begin != end) {
+    const char* new_line = static_cast<const char*>(
+        std::memchr(begin, '\n', end - begin));
+    const char* line_end = new_line ? new_line : end;
+
+    if (std::find_if(begin, line_end, [](char c) {
+        return !std::isspace(c, std::locale::classic()); }) != line_end)
+      lines++;
+
+    begin = new_line ? new_line + 1 : end;
+  }
+
+  return lines;
+}
+
 }
 
 namespace bvh {
@@ -42,69 +137,255 @@ namespace bvh {
 //##############################################################################
 // Main parse function
 //##############################################################################
-int Bvh_parser::parse(const bf::path& path, Bvh* bvh) {
-  LOG(INFO) << "Parsing file : " << path;
+const int Bvh_parser::kCannotOpen;
+
+int Bvh_parser::parse(const bf::path& path, Bvh* bvh) const {
+  Context context;
+  context.path = path;
+  context.bvh = bvh;
+  int ret = parse_file(context);
+  return ret == kCannotOpen ? -1 : ret;
+}
+
+int Bvh_parser::parse(const bf::path& path, Bvh* bvh,
+    const Hierarchy_callback& on_hierarchy,
+    const Frame_callback& on_frame) const {
+  Context context;
+  context.path = path;
+  context.bvh = bvh;
+  context.on_hierarchy = &on_hierarchy;
+  context.on_frame = &on_frame;
+  int ret = parse_file(context);
+  return ret == kCannotOpen ? -1 : ret;
+}
+
+int Bvh_parser::parse_file(Context& context) const {
+  LOG(INFO) << "Parsing file : " << context.path;
+
+  //############################################################################
+  // Loading binary snapshot instead of parsing
+  //############################################################################
+  bf::path snapshot;
+  std::string key;
+  if (!cache_directory_.empty() && context.on_frame == nullptr &&
+      load_mode_ == Load_mode::EAGER && !partial_load()) {
+    boost::system::error_code error;
+    snapshot = cache_path(context.path, &key);
+
+    if (!snapshot.empty() && bf::exists(snapshot, error) &&
+        load_binary(snapshot, context.bvh, key) == 0) {
+      LOG(INFO) << "Loaded snapshot : " << snapshot;
+      return 0;
+    }
+  }
+
+  context.file = std::make_shared<File_buffer>();
+
+  if (context.file->open(context.path)) {
+    LOG(ERROR) << "Cannot open file to parse : " << context.path;
+    return kCannotOpen;
+  }
+
+  int ret = parse_content(context);
+  if (ret)
+    return ret;
+
+  LOG(INFO) << "Successfully parsed file";
+
+  if (!snapshot.empty())
+    save_cache(*context.bvh, snapshot, key);
+
+  return 0;
+}
+
+int Bvh_parser::parse_buffer(boost::string_view content, Bvh* bvh) const {
+  LOG(INFO) << "Parsing buffer of " << content.size() << " characters";
+
+  Context context;
+  context.bvh = bvh;
+  context.file = std::make_shared<File_buffer>();
+
+  // Lazy motion matrix keeps the content, so it cannot view caller's memory
+  if (load_mode_ == Load_mode::LAZY)
+    context.file->assign(content.data(), content.size());
+  else
+    context.file->open(content.data(), content.size());
+
+  return parse_content(context);
+}
 
-  path_ = path;
-  bvh_ = bvh;
+int Bvh_parser::parse(std::istream& stream, Bvh* bvh) const {
+  LOG(INFO) << "Parsing stream";
 
-  bf::ifstream file;
-  file.open(path_);
+  Context context;
+  context.bvh = bvh;
+  context.file = std::make_shared<File_buffer>();
 
-  if (file.is_open()) {
-    std::string token;
+  if (context.file->open(stream)) {
+    LOG(ERROR) << "Cannot read stream to parse";
+    return -1;
+  }
+
+  return parse_content(context);
+}
+
+int Bvh_parser::parse_content(Context& context) const {
+  context.partial = context.on_frame == nullptr && partial_load();
+
+  Tokenizer tokenizer(context.file->data(),
+      context.file->data() + context.file->size());
+  boost::string_view token;
 
 #if MULTI_HIERARCHY == 1
-    while (file.good()) {
+  while (tokenizer.good()) {
 #endif
-      file >> token;
-      if (token == kHierarchy) {
-        int ret = parse_hierarchy(file);
-        if (ret)
-          return ret;
-      } else {
-        LOG(ERROR) << "Bad structure of .bvh file. " << kHierarchy
-                   << " should be on the top of the file";
-        return -1;
-      }
-#if MULTI_HIERARCHY == 1
+    tokenizer.next(token);
+    if (token == kHierarchy) {
+      int ret = parse_hierarchy(context, tokenizer);
+      if (ret)
+        return ret;
+    } else {
+      LOG(ERROR) << "Bad structure of .bvh file. " << kHierarchy
+                 << " should be on the top of the file";
+      return -1;
     }
+#if MULTI_HIERARCHY == 1
+  }
 #endif
-  } else {
-    LOG(ERROR) << "Cannot open file to parse : " << path_;
+
+  return 0;
+}
+
+//##############################################################################
+// Batch parse functions
+//##############################################################################
+int Bvh_parser::parse_batch(const std::vector <bf::path>& paths,
+    std::vector <Bvh>& bvhs, std::vector <int>& errors) const {
+  LOG(INFO) << "Parsing batch of " << paths.size() << " files";
+
+  bvhs.clear();
+  bvhs.resize(paths.size());
+  errors.assign(paths.size(), -1);
+
+  std::shared_ptr <Thread_pool> pool = thread_pool_ ? thread_pool_ :
+      std::make_shared<Thread_pool>();
+
+  // Result of parse_file keeps whether file could not be opened
+  pool->parallel_for(paths.size(), [&](unsigned i) {
+    Context context;
+    context.path = paths[i];
+    context.bvh = &bvhs[i];
+    errors[i] = parse_file(context);
+  });
+
+  unsigned failed = paths.size() - std::count(errors.begin(), errors.end(),
+      0);
+  if (failed) {
+    LOG(ERROR) << "Cannot parse " << failed << " of " << paths.size()
+               << " files";
     return -1;
   }
 
-  LOG(INFO) << "Successfully parsed file";
   return 0;
 }
 
+int Bvh_parser::parse_batch(const bf::path& directory,
+    const std::string& pattern, std::vector <bf::path>& paths,
+    std::vector <Bvh>& bvhs, std::vector <int>& errors) const {
+  boost::system::error_code error;
+  bf::directory_iterator entry(directory, error), end;
+  paths.clear();
+
+  for (; !error && entry != end; entry.increment(error)) {
+    if (bf::is_regular_file(entry->status()) &&
+        match_wildcard(pattern, entry->path().filename().string()))
+      paths.push_back(entry->path());
+  }
+
+  if (error) {
+    LOG(ERROR) << "Cannot read directory : " << directory;
+    bvhs.clear();
+    errors.clear();
+    return -1;
+  }
+
+  std::sort(paths.begin(), paths.end());
+  return parse_batch(paths, bvhs, errors);
+}
+
+//##############################################################################
+// Cache functions
+//##############################################################################
+bf::path Bvh_parser::cache_path(const bf::path& path, std::string* key)
+    const {
+  boost::system::error_code error;
+  bf::path canonical = bf::canonical(path, error);
+  if (error || !bf::is_regular_file(canonical, error) || error)
+    return bf::path();
+
+  std::uintmax_t size = bf::file_size(canonical, error);
+  if (error)
+    return bf::path();
+
+  std::time_t time = bf::last_write_time(canonical, error);
+  if (error)
+    return bf::path();
+
+  std::ostringstream file_key;
+  file_key << canonical.string() << '\n' << size << '\n' << time;
+  *key = file_key.str();
+
+  std::ostringstream name;
+  name << std::hex << std::setw(16) << std::setfill('0')
+       << fnv1a_hash(*key) << ".bvhb";
+  return cache_directory_ / name.str();
+}
+
+void Bvh_parser::save_cache(const Bvh& bvh, const bf::path& cache_path,
+    const std::string& key) const {
+  boost::system::error_code error;
+  bf::create_directories(cache_directory_, error);
+
+  // Renaming is atomic, so other parsers see whole snapshot or nothing
+  bf::path temporary = cache_path.parent_path() / bf::unique_path(
+      cache_path.filename().string() + ".%%%%-%%%%-%%%%");
+
+  if (save_binary(bvh, temporary, key) == 0) {
+    bf::rename(temporary, cache_path, error);
+    if (!error)
+      return;
+  }
+
+  LOG(WARNING) << "Cannot save snapshot : " << cache_path;
+  bf::remove(temporary, error);
+}
+
 //##############################################################################
 // Function parsing hierarchy
 //##############################################################################
-int Bvh_parser::parse_hierarchy(std::ifstream& file) {
+int Bvh_parser::parse_hierarchy(Context& context, Tokenizer& tokenizer)
+    const {
   LOG(INFO) << "Parsing hierarchy";
 
-  std::string token;
+  boost::string_view token;
   int ret;
 
-  if (file.good()) {
-    file >> token;
+  if (tokenizer.next(token)) {
 
     //##########################################################################
     // Parsing joints
     //##########################################################################
     if (token == kRoot) {
       std::shared_ptr <Joint> rootJoint;
-      ret = parse_joint(file, nullptr, rootJoint);
+      ret = parse_joint(context, tokenizer, nullptr, rootJoint);
 
       if (ret)
         return ret;
 
-      LOG(INFO) << "There is " << bvh_->num_channels() << " data channels in the"
-                << " file";
+      LOG(INFO) << "There is " << context.bvh->num_channels() << " data "
+                << "channels in the file";
 
-      bvh_->set_root_joint(rootJoint);
+      context.bvh->set_root_joint(rootJoint);
     } else {
       LOG(ERROR) << "Bad structure of .bvh file. Expected " << kRoot
                  << ", but found \"" << token << "\"";
@@ -112,14 +393,13 @@ int Bvh_parser::parse_hierarchy(std::ifstream& file) {
     }
   }
 
-  if (file.good()) {
-    file >> token;
+  if (tokenizer.next(token)) {
 
     //##########################################################################
     // Parsing motion data
     //##########################################################################
     if (token == kMotion) {
-      ret = parse_motion(file);
+      ret = parse_motion(context, tokenizer);
 
       if (ret)
         return ret;
@@ -135,27 +415,27 @@ int Bvh_parser::parse_hierarchy(std::ifstream& file) {
 //##############################################################################
 // Function parsing joint
 //##############################################################################
-int Bvh_parser::parse_joint(std::ifstream& file,
-    std::shared_ptr <Joint> parent, std::shared_ptr <Joint>& parsed) {
+int Bvh_parser::parse_joint(Context& context, Tokenizer& tokenizer,
+    std::shared_ptr <Joint> parent, std::shared_ptr <Joint>& parsed) const {
 
   LOG(TRACE) << "Parsing joint";
 
   std::shared_ptr<Joint> joint = std::make_shared<Joint>();
   joint->set_parent(parent);
 
-  std::string name;
-  file >> name;
+  boost::string_view name;
+  tokenizer.next(name);
 
   LOG(TRACE) << "Joint name : " << name;
 
-  joint->set_name(name);
+  joint->set_name(name.to_string());
 
-  std::string token;
+  boost::string_view token;
   std::vector <std::shared_ptr <Joint>> children;
   int ret;
 
-  file >> token;  // Consuming '{'
-  file >> token;
+  tokenizer.next(token);  // Consuming '{'
+  tokenizer.next(token);
 
   //############################################################################
   // Offset parsing
@@ -163,9 +443,8 @@ int Bvh_parser::parse_joint(std::ifstream& file,
   if (token == kOffset) {
     Joint::Offset offset;
 
-    try {
-      file >> offset.x >> offset.y >> offset.z;
-    } catch (const std::ios_base::failure e) {
+    if (!tokenizer.next(offset.x) || !tokenizer.next(offset.y) ||
+        !tokenizer.next(offset.z)) {
       LOG(ERROR) << "Failure while parsing offset";
       return -1;
     }
@@ -182,13 +461,13 @@ int Bvh_parser::parse_joint(std::ifstream& file,
     return -1;
   }
 
-  file >> token;
+  tokenizer.next(token);
 
   //############################################################################
   // Channels parsing
   //############################################################################
   if (token == kChannels) {
-    ret = parse_channel_order(file, joint);
+    ret = parse_channel_order(tokenizer, joint);
 
     LOG(TRACE) << "Joint has " << joint->num_channels() << " data channels";
 
@@ -201,21 +480,34 @@ int Bvh_parser::parse_joint(std::ifstream& file,
     return -1;
   }
 
-  file >> token;
+  //############################################################################
+  // Skipping channels of joints that are not loaded
+  //############################################################################
+  if (context.partial) {
+    bool loaded = joint_filter_.empty() ||
+        joint_filter_.count(name.to_string());
+    for (unsigned i = 0; i < joint->num_channels(); i++)
+      context.columns.push_back(loaded ? context.bvh->num_channels() + i : -1);
+
+    if (!loaded)
+      joint->set_channels_order(std::vector <Joint::Channel>());
+  }
+
+  bool has_token = tokenizer.next(token);
 
-  bvh_->add_joint(joint);
+  context.bvh->add_joint(joint);
 
   //############################################################################
   // Children parsing
   //############################################################################
 
-  while (file.good()) {
+  while (has_token) {
     //##########################################################################
     // Child joint parsing
     //##########################################################################
     if (token == kJoint) {
       std::shared_ptr <Joint> child;
-      ret = parse_joint(file, joint, child);
+      ret = parse_joint(context, tokenizer, joint, child);
 
       if (ret)
         return ret;
@@ -226,7 +518,8 @@ int Bvh_parser::parse_joint(std::ifstream& file,
     // Child joint parsing
     //##########################################################################
     } else if (token == kEnd) {
-      file >> token >> token;  // Consuming "Site {"
+      tokenizer.next(token);  // Consuming "Site"
+      tokenizer.next(token);  // Consuming "{"
 
       std::shared_ptr <Joint> tmp_joint = std::make_shared <Joint> ();
 
@@ -234,7 +527,7 @@ int Bvh_parser::parse_joint(std::ifstream& file,
       tmp_joint->set_name(kEndSite);
       children.push_back(tmp_joint);
 
-      file >> token;
+      tokenizer.next(token);
 
       //########################################################################
       // End site offset parsing
@@ -242,9 +535,8 @@ int Bvh_parser::parse_joint(std::ifstream& file,
       if (token == kOffset) {
         Joint::Offset offset;
 
-        try {
-          file >> offset.x >> offset.y >> offset.z;
-        } catch (const std::ios_base::failure e) {
+        if (!tokenizer.next(offset.x) || !tokenizer.next(offset.y) ||
+            !tokenizer.next(offset.z)) {
           LOG(ERROR) << "Failure while parsing offset";
           return -1;
         }
@@ -255,7 +547,7 @@ int Bvh_parser::parse_joint(std::ifstream& file,
         LOG(TRACE) << "Offset x: " << offset.x << ", y: " << offset.y << ", z: "
                    << offset.z;
 
-        file >> token;  // Consuming "}"
+        tokenizer.next(token);  // Consuming "}"
 
       } else {
         LOG(ERROR) << "Bad structure of .bvh file. Expected " << kOffset
@@ -264,7 +556,7 @@ int Bvh_parser::parse_joint(std::ifstream& file,
         return -1;
       }
 
-      bvh_->add_joint(tmp_joint);
+      context.bvh->add_joint(tmp_joint);
     //##########################################################################
     // End joint parsing
     //##########################################################################
@@ -274,7 +566,7 @@ int Bvh_parser::parse_joint(std::ifstream& file,
       return 0;
     }
 
-    file >> token;
+    has_token = tokenizer.next(token);
   }
 
   LOG(ERROR) << "Cannot parse joint, unexpected end of file. Last token : "
@@ -285,19 +577,33 @@ int Bvh_parser::parse_joint(std::ifstream& file,
 //##############################################################################
 // Motion data parse function
 //##############################################################################
-int Bvh_parser::parse_motion(std::ifstream& file) {
+int Bvh_parser::parse_motion(Context& context, Tokenizer& tokenizer) const {
 
   LOG(INFO) << "Parsing motion";
 
-  std::string token;
-  file >> token;
+  boost::string_view token;
+  tokenizer.next(token);
 
   int frames_num;
+  unsigned first_frame = 0;
 
   if (token == kFrames) {
-    file >> frames_num;
-    bvh_->set_num_frames(frames_num);
+    if (!tokenizer.next(frames_num) || frames_num < 0) {
+      LOG(ERROR) << "Failure while parsing number of frames";
+      return -1;
+    }
     LOG(INFO) << "Num of frames : " << frames_num;
+
+    if (context.partial) {
+      first_frame = std::min<unsigned>(first_frame_, frames_num);
+      frames_num = std::max(first_frame,
+          std::min<unsigned>(last_frame_, frames_num)) - first_frame;
+      LOG(INFO) << "Loading " << frames_num << " frames from frame "
+                << first_frame;
+    }
+
+    context.bvh->set_num_frames(frames_num,
+        context.on_frame == nullptr && load_mode_ == Load_mode::EAGER);
   } else {
     LOG(ERROR) << "Bad structure of .bvh file. Expected " << kFrames
                << ", but found \"" << token << "\"";
@@ -305,27 +611,47 @@ int Bvh_parser::parse_motion(std::ifstream& file) {
     return -1;
   }
 
-  file >> token;
+  tokenizer.next(token);
 
   double frame_time;
 
   if (token == kFrame) {
-    file >> token;  // Consuming 'Time:'
-    file >> frame_time;
-    bvh_->set_frame_time(frame_time);
+    tokenizer.next(token);  // Consuming 'Time:'
+    if (!tokenizer.next(frame_time)) {
+      LOG(ERROR) << "Failure while parsing frame time";
+      return -1;
+    }
+    context.bvh->set_frame_time(frame_time);
     LOG(INFO) << "Frame time : " << frame_time;
 
-    float number;
-    for (int i = 0; i < frames_num; i++) {
-      for (auto joint : bvh_->joints()) {
-        std::vector <float> data;
-        for (int j = 0; j < joint->num_channels(); j++) {
-          file >> number;
-          data.push_back(number);
-        }
-        // LOG(TRACE) << joint->name() << ": " << vtos(data);
-        joint->add_frame_motion_data(data);
-      }
+    if (context.on_frame) {
+      int ret = *context.on_hierarchy ? (*context.on_hierarchy)(*context.bvh) :
+          0;
+      return ret ? callback_result(ret) :
+          stream_frames(context, tokenizer, frames_num);
+    }
+
+    if (load_mode_ == Load_mode::HIERARCHY_ONLY)
+      return 0;
+
+    if (load_mode_ == Load_mode::LAZY)
+      return index_frames(context, tokenizer, frames_num);
+
+    if (context.partial)
+      return parse_frames_partial(context, tokenizer, first_frame, frames_num);
+
+    if (thread_pool_ && frames_num >= kMinParallelFrames) {
+      if (parse_frames_parallel(context, tokenizer, frames_num) == 0)
+        return 0;
+
+      LOG(WARNING) << "Motion data is not stored frame per line, falling "
+                   << "back to sequential parsing";
+    }
+
+    unsigned parsed = parse_frames(context, tokenizer, 0, frames_num);
+    if (parsed != frames_num) {
+      LOG(ERROR) << "Failure while parsing motion data of frame " << parsed;
+      return -1;
     }
   } else {
     LOG(ERROR) << "Bad structure of .bvh file. Expected " << kFrame
@@ -337,23 +663,197 @@ int Bvh_parser::parse_motion(std::ifstream& file) {
   return 0;
 }
 
+//##############################################################################
+// Frames data parse function
+//##############################################################################
+unsigned Bvh_parser::parse_frames(Context& context, Tokenizer& tokenizer,
+    unsigned first_frame, unsigned num_frames) const {
+  Motion& motion = context.bvh->motion();
+
+  for (unsigned i = 0; i < num_frames; i++) {
+    float* data = motion.frame(first_frame + i);
+    for (unsigned j = 0; j < motion.num_channels(); j++) {
+      if (!tokenizer.next(data[j]))
+        return i;
+    }
+  }
+
+  return num_frames;
+}
+
+//##############################################################################
+// Streamed frames data parse function
+//##############################################################################
+int Bvh_parser::stream_frames(Context& context, Tokenizer& tokenizer,
+    unsigned num_frames) const {
+  std::vector <float> data(context.bvh->num_channels());
+
+  for (unsigned i = 0; i < num_frames; i++) {
+    for (unsigned j = 0; j < data.size(); j++) {
+      if (!tokenizer.next(data[j])) {
+        LOG(ERROR) << "Failure while parsing motion data of frame " << i;
+        return -1;
+      }
+    }
+
+    if (!*context.on_frame)
+      continue;
+
+    int ret = (*context.on_frame)(i,
+        Span<const float>(data.data(), data.size()));
+    if (ret)
+      return callback_result(ret);
+  }
+
+  return 0;
+}
+
+//##############################################################################
+// Partial frames data parse function
+//##############################################################################
+int Bvh_parser::parse_frames_partial(Context& context, Tokenizer& tokenizer,
+    unsigned first, unsigned num_frames) const {
+  boost::string_view token;
+
+  // Skipped values are only split, not converted
+  std::size_t skipped = static_cast<std::size_t>(first) *
+      context.columns.size();
+  for (std::size_t i = 0; i < skipped; i++) {
+    if (!tokenizer.next(token)) {
+      LOG(ERROR) << "Failure while skipping motion data of frame "
+                 << i / context.columns.size();
+      return -1;
+    }
+  }
+
+  Motion& motion = context.bvh->motion();
+
+  for (unsigned i = 0; i < num_frames; i++) {
+    float* data = motion.frame(i);
+    for (int column : context.columns) {
+      bool read = column < 0 ? tokenizer.next(token) :
+          tokenizer.next(data[column]);
+      if (!read) {
+        LOG(ERROR) << "Failure while parsing motion data of frame "
+                   << first + i;
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+//##############################################################################
+// Frames data index function
+//##############################################################################
+int Bvh_parser::index_frames(Context& context, const Tokenizer& tokenizer,
+    unsigned num_frames) const {
+  std::size_t motion_offset = tokenizer.position() - context.file->data();
+  std::shared_ptr <Frame_index> index = std::make_shared<Frame_index>();
+  bf::path index_path = Frame_index::index_path(context.path);
+
+  // Index is saved only for regular files, which have modification time
+  boost::system::error_code error;
+  std::time_t file_time = context.path.empty() ? 0 :
+      bf::last_write_time(context.path, error);
+  bool persistent = !context.path.empty() && !error &&
+      bf::is_regular_file(context.path, error) && !error;
+
+  if (persistent && index->load(index_path, context.file->size(), file_time,
+      motion_offset, num_frames, context.bvh->num_channels()) == 0) {
+    LOG(INFO) << "Using frame index : " << index_path;
+  } else {
+    if (index->build(context.file->data(), context.file->size(),
+        motion_offset, num_frames, context.bvh->num_channels())) {
+      LOG(ERROR) << "Failure while indexing motion data, there is less values "
+                 << "than " << num_frames << " frames need";
+      return -1;
+    }
+
+    if (persistent && save_frame_index_ &&
+        index->save(index_path, file_time)) {
+      LOG(WARNING) << "Cannot save frame index : " << index_path;
+    }
+  }
+
+  context.bvh->motion().set_lazy(context.file, index);
+  return 0;
+}
+
+//##############################################################################
+// Parallel frames data parse function
+//##############################################################################
+int Bvh_parser::parse_frames_parallel(Context& context,
+    const Tokenizer& tokenizer, unsigned num_frames) const {
+  const char* begin = tokenizer.position();
+  const char* end = tokenizer.end();
+
+  //############################################################################
+  // Splitting motion data into chunks at line boundaries
+  //############################################################################
+  unsigned num_chunks = thread_pool_->num_threads() * kChunksPerThread;
+  std::vector <const char*> bounds(num_chunks + 1, end);
+  bounds[0] = begin;
+
+  for (unsigned i = 1; i < num_chunks; i++) {
+    const char* split = std::max(begin + (end - begin) / num_chunks * i,
+        bounds[i - 1]);
+    const char* new_line = static_cast<const char*>(
+        std::memchr(split, '\n', end - split));
+    bounds[i] = new_line ? new_line + 1 : end;
+  }
+
+  //############################################################################
+  // Finding first frame of each chunk
+  //############################################################################
+  std::vector <unsigned> first_frames(num_chunks + 1, 0);
+  thread_pool_->parallel_for(num_chunks, [&](unsigned i) {
+    first_frames[i + 1] = count_lines(bounds[i], bounds[i + 1]);
+  });
+
+  for (unsigned i = 0; i < num_chunks; i++)
+    first_frames[i + 1] += first_frames[i];
+
+  if (first_frames[num_chunks] != num_frames)
+    return -1;
+
+  //############################################################################
+  // Parsing chunks
+  //############################################################################
+  std::atomic<bool> failed(false);
+  thread_pool_->parallel_for(num_chunks, [&](unsigned i) {
+    Tokenizer chunk(bounds[i], bounds[i + 1]);
+    unsigned chunk_frames = first_frames[i + 1] - first_frames[i];
+
+    if (parse_frames(context, chunk, first_frames[i], chunk_frames) !=
+        chunk_frames || chunk.good())
+      failed = true;
+  });
+
+  return failed ? -1 : 0;
+}
+
 //##############################################################################
 // Channels order parse function
 //##############################################################################
-int Bvh_parser::parse_channel_order(std::ifstream& file,
-    std::shared_ptr <Joint> joint) {
+int Bvh_parser::parse_channel_order(Tokenizer& tokenizer,
+    std::shared_ptr <Joint> joint) const {
 
   LOG(TRACE) << "Parse channel order";
 
   int num;
-  file >> num;
+  if (!tokenizer.next(num)) {
+    LOG(ERROR) << "Failure while parsing number of channels";
+    return -1;
+  }
   LOG(TRACE) << "Number of channels : " << num;
 
   std::vector <Joint::Channel> channels;
-  std::string token;
+  boost::string_view token;
 
   for (int i = 0; i < num; i++) {
-    file >> token;
+    tokenizer.next(token);
     if (token == kXpos)
       channels.push_back(Joint::Channel::XPOSITION);
     else if (token == kYpos)
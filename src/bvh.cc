@@ -1,13 +1,148 @@
 #include "bvh.h"
 
 #include "easylogging++.h"
+#include "fk-simd.h"
 #include "utils.h"
 
+#include <algorithm>
+#include <cmath>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+namespace {
+
+/** Minimal number of frames for which transforms are calculated in parallel */
+const unsigned kMinParallelFrames = 64;
+
+/** Number of frame ranges per thread, more ranges balance load better */
+const unsigned kRangesPerThread = 4;
+
+/** Creates quaternion of rotation around single axis
+ *  @param  angle  The rotation angle in degrees
+ *  @param  axis   The rotation axis
+ *  @return  The rotation quaternion
+ */
+glm::quat axis_rotation(float angle, utils::Axis axis) {
+  float half_angle = glm::radians(angle) * 0.5f;
+  float sin_a = std::sin(half_angle);
+  float cos_a = std::cos(half_angle);
+
+  if (axis == utils::Axis::X)
+    return glm::quat(cos_a, sin_a, 0.0f, 0.0f);
+  else if (axis == utils::Axis::Y)
+    return glm::quat(cos_a, 0.0f, sin_a, 0.0f);
+  else
+    return glm::quat(cos_a, 0.0f, 0.0f, sin_a);
+}
+
+/** Rotation and translation matrices built from joint's channels */
+struct Matrix_channels {
+  Matrix_channels() : rmat(1.0), tmat(1.0) {}
+
+  void translate_x(float value) {
+    tmat = glm::translate(tmat, glm::vec3(value, 0, 0));
+  }
+  void translate_y(float value) {
+    tmat = glm::translate(tmat, glm::vec3(0, value, 0));
+  }
+  void translate_z(float value) {
+    tmat = glm::translate(tmat, glm::vec3(0, 0, value));
+  }
+  void rotate_x(float value) {
+    rmat = utils::rotate(rmat, value, utils::Axis::X);
+  }
+  void rotate_y(float value) {
+    rmat = utils::rotate(rmat, value, utils::Axis::Y);
+  }
+  void rotate_z(float value) {
+    rmat = utils::rotate(rmat, value, utils::Axis::Z);
+  }
+  /** Known orders rotate once, when rotation matrix is still identity */
+  template <bvh::Euler_order Order>
+  void rotate(float first, float second, float third) {
+    rmat = glm::mat4(bvh::euler_matrix<Order>(first, second, third));
+  }
+
+  /** Rotation matrix */
+  glm::mat4 rmat;
+  /** Translation matrix */
+  glm::mat4 tmat;
+};
+
+/** 3x3 rotation matrix and translation built from joint's channels */
+struct Affine_channels {
+  Affine_channels() : rmat(1.0), translation(0.0f) {}
+
+  void translate_x(float value) { translation.x += value; }
+  void translate_y(float value) { translation.y += value; }
+  void translate_z(float value) { translation.z += value; }
+  void rotate_x(float value) {
+    rmat = utils::rotate(rmat, value, utils::Axis::X);
+  }
+  void rotate_y(float value) {
+    rmat = utils::rotate(rmat, value, utils::Axis::Y);
+  }
+  void rotate_z(float value) {
+    rmat = utils::rotate(rmat, value, utils::Axis::Z);
+  }
+  /** Known orders rotate once, when rotation matrix is still identity */
+  template <bvh::Euler_order Order>
+  void rotate(float first, float second, float third) {
+    rmat = bvh::euler_matrix<Order>(first, second, third);
+  }
+
+  /** Rotation matrix */
+  glm::mat3 rmat;
+  /** Translation vector */
+  glm::vec3 translation;
+};
+
+/** Rotation quaternion and translation built from joint's channels */
+struct Quaternion_channels {
+  Quaternion_channels() : rotation(1.0f, 0.0f, 0.0f, 0.0f),
+      translation(0.0f) {}
+
+  void translate_x(float value) { translation.x += value; }
+  void translate_y(float value) { translation.y += value; }
+  void translate_z(float value) { translation.z += value; }
+  void rotate_x(float value) {
+    rotation = rotation * axis_rotation(value, utils::Axis::X);
+  }
+  void rotate_y(float value) {
+    rotation = rotation * axis_rotation(value, utils::Axis::Y);
+  }
+  void rotate_z(float value) {
+    rotation = rotation * axis_rotation(value, utils::Axis::Z);
+  }
+  template <bvh::Euler_order Order>
+  void rotate(float first, float second, float third) {
+    rotate(bvh::euler_channel(Order, 0), first);
+    rotate(bvh::euler_channel(Order, 1), second);
+    rotate(bvh::euler_channel(Order, 2), third);
+  }
+  void rotate(bvh::Joint::Channel channel, float value) {
+    if (channel == bvh::Joint::Channel::XROTATION)
+      rotate_x(value);
+    else if (channel == bvh::Joint::Channel::YROTATION)
+      rotate_y(value);
+    else
+      rotate_z(value);
+  }
+
+  /** Rotation quaternion */
+  glm::quat rotation;
+  /** Translation vector */
+  glm::vec3 translation;
+};
+
+} // namespace
 
 namespace bvh {
 
-void Bvh::recalculate_joints_ltm(std::shared_ptr<Joint> start_joint) {
+const int Skeleton::kNoParent;
+
+void Bvh::recalculate_joints_ltm(std::shared_ptr<Joint> start_joint,
+    Fk_method method) {
 
       if (start_joint == NULL)
   {
@@ -19,52 +154,302 @@ void Bvh::recalculate_joints_ltm(std::shared_ptr<Joint> start_joint) {
 
   LOG(DEBUG) << "recalculate_joints_ltm: " << start_joint->name();
 
-  glm::mat4 offmat_backup = glm::translate(glm::mat4(1.0),
-        glm::vec3(start_joint->offset().x, start_joint->offset().y,
-        start_joint->offset().z));
-
-  std::vector<std::vector<float>> data = start_joint->channel_data();
-
-  for (int i = 0; i < num_frames_; i++) {
-    glm::mat4 offmat = offmat_backup; // offset matrix
-    glm::mat4 rmat(1.0);  // identity matrix set on rotation matrix
-    glm::mat4 tmat(1.0);  // identity matrix set on translation matrix
-
-    for (int j = 0;  j < start_joint->channels_order().size(); j++) {
-      if (start_joint->channels_order()[j] == Joint::Channel::XPOSITION)
-        tmat = glm::translate(tmat, glm::vec3(data[i][j], 0, 0));
-      else if (start_joint->channels_order()[j] == Joint::Channel::YPOSITION)
-        tmat = glm::translate(tmat, glm::vec3(0, data[i][j], 0));
-      else if (start_joint->channels_order()[j] == Joint::Channel::ZPOSITION)
-        tmat = glm::translate(tmat, glm::vec3(0, 0, data[i][j]));
-      else if (start_joint->channels_order()[j] == Joint::Channel::XROTATION)
-        rmat = utils::rotate(rmat, data[i][j], utils::Axis::X);
-      else if (start_joint->channels_order()[j] == Joint::Channel::YROTATION)
-        rmat = utils::rotate(rmat, data[i][j], utils::Axis::Y);
-      else if (start_joint->channels_order()[j] == Joint::Channel::ZROTATION)
-        rmat = utils::rotate(rmat, data[i][j], utils::Axis::Z);
-    }
+  // Joints are kept in depth-first order, so walking subtree range in order
+  // always calculates parent before its children
+  unsigned first_joint = start_joint->index();
+  unsigned last_joint = skeleton_->subtree_end(first_joint);
+
+  bool affine = transform_storage_ == Transform_storage::AFFINE;
 
-    glm::mat4 ltm; // local transformation matrix
+  // Number of frames of file can be greater than number of frames in motion
+  // matrix, ex. after streaming parse, so only frames in matrix are used
+  unsigned num_frames = motion_->num_frames();
 
-    if (start_joint->parent() != NULL)
-      ltm = start_joint->parent()->ltm(i) * offmat;
+  // Rotations are stored only by quaternion calculation
+  if (transform_storage_ == Transform_storage::QUATERNION)
+    method = Fk_method::QUATERNION;
+
+  for (unsigned joint = first_joint; joint < last_joint; joint++) {
+    if (affine)
+      joints_[joint]->resize_affine_transforms(num_frames);
+    else if (transform_storage_ == Transform_storage::QUATERNION)
+      joints_[joint]->resize_quaternion_transforms(num_frames);
     else
-      ltm = tmat * offmat;
+      joints_[joint]->resize_transforms(num_frames);
+  }
+
+  if (num_frames == 0)
+    return;
+
+  //############################################################################
+  // Input of batched calculation
+  //############################################################################
+
+  std::vector <simd::Joint_input> simd_joints;
+
+  if (method == Fk_method::SIMD) {
+    // Parents outside of subtree are read by index, so all joints are set
+    simd_joints.resize(joints_.size());
+    for (unsigned joint = 0; joint < joints_.size(); joint++) {
+      simd::Joint_input& input = simd_joints[joint];
+      const Joint::Offset& offset = skeleton_->offset(joint);
+
+      input.parent = skeleton_->parent(joint);
+      input.offset[0] = offset.x;
+      input.offset[1] = offset.y;
+      input.offset[2] = offset.z;
+      input.channel_offset = skeleton_->channel_offset(joint);
+      input.num_channels = skeleton_->num_channels(joint);
+      input.channels = skeleton_->channels_order(joint).data();
+      input.ltm = nullptr;
+      input.pos = nullptr;
+      if (affine && !joints_[joint]->affine_ltm().empty()) {
+        input.ltm = &joints_[joint]->affine_ltm_data()[0][0][0];
+      } else if (!affine && !joints_[joint]->ltm().empty()) {
+        input.ltm = &joints_[joint]->ltm_data()[0][0][0];
+        input.pos = &joints_[joint]->pos_data()[0][0];
+      }
+    }
+  }
+
+  simd::Input simd_input = {simd_joints.data(), first_joint, last_joint,
+      motion_->frame(0), num_channels_, affine};
+
+  auto calculate = [&](unsigned first_frame, unsigned last_frame) {
+    // Batched calculation reads motion matrix directly, not through frame()
+    motion_->load(first_frame, last_frame);
+
+    if (method == Fk_method::SIMD) {
+      simd::calculate(simd_input, first_frame, last_frame);
+    } else if (method == Fk_method::QUATERNION) {
+      calculate_joints_quaternion(first_joint, last_joint, first_frame,
+          last_frame);
+    } else {
+      for (unsigned joint = first_joint; joint < last_joint; joint++) {
+        if (affine)
+          calculate_joint_affine(joint, first_frame, last_frame);
+        else
+          calculate_joint_ltm(joint, first_frame, last_frame);
+      }
+    }
+  };
+
+  //############################################################################
+  // Calculation of frame ranges
+  //############################################################################
+
+  if (!thread_pool_ || num_frames < kMinParallelFrames) {
+    calculate(0, num_frames);
+    return;
+  }
+
+  // Frames are independent, so each range goes through whole subtree
+  unsigned num_ranges = std::min(num_frames,
+      thread_pool_->num_threads() * kRangesPerThread);
+
+  thread_pool_->parallel_for(num_ranges, [&](unsigned range) {
+    unsigned first_frame = static_cast<unsigned long long>(num_frames) *
+        range / num_ranges;
+    unsigned last_frame = static_cast<unsigned long long>(num_frames) *
+        (range + 1) / num_ranges;
+
+    calculate(first_frame, last_frame);
+  });
+}
+
+std::size_t Bvh::memory_size() const {
+  std::size_t size = sizeof(Bvh) + motion_->memory_size() +
+      skeleton_->memory_size() +
+      joints_.capacity() * sizeof(std::shared_ptr<Joint>);
+  for (const std::shared_ptr<Joint>& joint : joints_)
+    size += joint->memory_size();
+  return size;
+}
+
+int Bvh::calculate_pose(unsigned frame, glm::mat4* ltm, glm::vec3* pos)
+    const {
+  return calculate_poses(Span<const unsigned>(&frame, 1), ltm, pos);
+}
+
+int Bvh::calculate_poses(Span<const unsigned> frames, glm::mat4* ltm,
+    glm::vec3* pos) const {
+  unsigned num_joints = skeleton_->num_joints();
+
+  for (unsigned frame : frames) {
+    if (frame >= motion_->num_frames()) {
+      LOG(ERROR) << "Frame " << frame << " is out of range of "
+                 << motion_->num_frames() << " frames";
+      return -1;
+    }
+  }
+
+  for (unsigned i = 0; i < frames.size(); i++) {
+    const float* data = motion_->frame(frames[i]);
+    glm::mat4* pose_ltm = ltm + static_cast<std::size_t>(i) * num_joints;
+
+    // Parents precede their children, so they are already in the buffer
+    for (unsigned joint = 0; joint < num_joints; joint++) {
+      int parent = skeleton_->parent(joint);
+      const Joint::Offset& offset = skeleton_->offset(joint);
+      glm::vec3 joint_pos;
+
+      calculate_transform(data + skeleton_->channel_offset(joint),
+          skeleton_->program(joint), skeleton_->channels_order(joint),
+          glm::translate(glm::mat4(1.0),
+          glm::vec3(offset.x, offset.y, offset.z)),
+          parent != Skeleton::kNoParent ? &pose_ltm[parent] : nullptr,
+          pose_ltm[joint], joint_pos);
+
+      if (pos)
+        pos[static_cast<std::size_t>(i) * num_joints + joint] = joint_pos;
+    }
+  }
+
+  return 0;
+}
 
-    start_joint->set_pos(ltm[3]);
-    LOG(TRACE) << "Joint world position: " << utils::vec3tos(ltm[3]);
+void Bvh::calculate_joint_ltm(unsigned joint, unsigned first_frame,
+    unsigned last_frame) {
+  Joint& current = *joints_[joint];
+  int parent = skeleton_->parent(joint);
+  const glm::mat4* parent_ltm = parent != Skeleton::kNoParent ?
+      joints_[parent]->ltm().data() : nullptr;
+  const Joint::Offset& offset = skeleton_->offset(joint);
 
-    ltm = ltm * rmat;
+  const glm::mat4 offmat = glm::translate(glm::mat4(1.0),
+      glm::vec3(offset.x, offset.y, offset.z));  // offset matrix
 
-    LOG(TRACE) << "Local transformation matrix: \n" << utils::mat4tos(ltm);
+  glm::mat4 ltm;
+  glm::vec3 pos;
 
-    start_joint->set_ltm(ltm, i);
+  for (unsigned i = first_frame; i < last_frame; i++) {
+    calculate_transform(motion_->frame(i) + current.channel_offset(),
+        skeleton_->program(joint), skeleton_->channels_order(joint), offmat,
+        parent_ltm ? &parent_ltm[i] : nullptr, ltm, pos);
+    current.set_transform(i, ltm, pos);
   }
+}
+
+void Bvh::calculate_joint_affine(unsigned joint, unsigned first_frame,
+    unsigned last_frame) {
+  Joint& current = *joints_[joint];
+  int parent = skeleton_->parent(joint);
+  Span<const Joint::Channel> channels = skeleton_->channels_order(joint);
+  const Channel_program& program = skeleton_->program(joint);
+  const glm::mat4x3* parent_ltm = parent != Skeleton::kNoParent ?
+      joints_[parent]->affine_ltm().data() : nullptr;
+  const Joint::Offset& offset = skeleton_->offset(joint);
+
+  for (unsigned i = first_frame; i < last_frame; i++) {
+    Affine_channels local;
+    program.apply(motion_->frame(i) + current.channel_offset(), channels,
+        local);
+    const glm::mat3& rmat = local.rmat;
+
+    // Bottom row of affine matrices is (0, 0, 0, 1), so only rotation part
+    // and translation column are multiplied
+    if (parent_ltm) {
+      const glm::mat4x3& p = parent_ltm[i];
+      glm::mat3 prot(p[0], p[1], p[2]);
+      current.set_affine_transform(i, glm::mat4x3(prot * rmat[0],
+          prot * rmat[1], prot * rmat[2], p[0] * offset.x + p[1] * offset.y +
+          p[2] * offset.z + p[3]));
+    } else {
+      current.set_affine_transform(i, glm::mat4x3(rmat[0], rmat[1], rmat[2],
+          glm::vec3(offset.x, offset.y, offset.z) + local.translation));
+    }
+  }
+}
+
+void Bvh::calculate_joints_quaternion(unsigned first_joint,
+    unsigned last_joint, unsigned first_frame, unsigned last_frame) {
+  bool affine = transform_storage_ == Transform_storage::AFFINE;
+  bool quaternion = transform_storage_ == Transform_storage::QUATERNION;
+
+  // World rotations and positions of current frame, from first joint
+  std::vector <glm::quat> rotations(last_joint - first_joint);
+  std::vector <glm::vec3> positions(last_joint - first_joint);
+
+  for (unsigned i = first_frame; i < last_frame; i++) {
+    const float* frame = motion_->frame(i);
+
+    for (unsigned joint = first_joint; joint < last_joint; joint++) {
+      Span<const Joint::Channel> channels = skeleton_->channels_order(joint);
+      const float* data = frame + skeleton_->channel_offset(joint);
+      const Joint::Offset& offset = skeleton_->offset(joint);
+      int parent = skeleton_->parent(joint);
+
+      Quaternion_channels local;
+      skeleton_->program(joint).apply(data, channels, local);
 
-  for (auto& child : start_joint->children()) {
-    recalculate_joints_ltm(child);
+      glm::quat& world_rotation = rotations[joint - first_joint];
+      glm::vec3& world_position = positions[joint - first_joint];
+      glm::vec3 joint_offset(offset.x, offset.y, offset.z);
+
+      if (parent == Skeleton::kNoParent) {
+        world_rotation = local.rotation;
+        world_position = joint_offset + local.translation;
+      } else {
+        glm::quat parent_rotation;
+        glm::vec3 parent_position;
+
+        if (parent >= static_cast<int>(first_joint)) {
+          parent_rotation = rotations[parent - first_joint];
+          parent_position = positions[parent - first_joint];
+        } else if (quaternion) {
+          parent_rotation = joints_[parent]->rotation(i);
+          parent_position = joints_[parent]->pos(i);
+        } else {
+          // Parent outside of range is read from its stored matrix
+          const Joint& parent_joint = *joints_[parent];
+          glm::mat4 parent_matrix = parent_joint.transform_matrix(i);
+          glm::mat3 parent_rmat;
+          for (int col = 0; col < 3; col++)
+            parent_rmat[col] = glm::vec3(parent_matrix[col]);
+          parent_rotation = glm::quat_cast(parent_rmat);
+          parent_position = glm::vec3(parent_matrix[3]);
+        }
+
+        world_rotation = parent_rotation * local.rotation;
+        world_position = parent_position + parent_rotation * joint_offset;
+      }
+
+      if (quaternion) {
+        joints_[joint]->set_rotation(i, world_rotation, world_position);
+        continue;
+      }
+
+      // Matrices are built only for matrix storages
+      glm::mat3 rmat = glm::mat3_cast(world_rotation);
+
+      if (affine) {
+        joints_[joint]->set_affine_transform(i, glm::mat4x3(rmat[0], rmat[1],
+            rmat[2], world_position));
+      } else {
+        joints_[joint]->set_transform(i, glm::mat4(glm::vec4(rmat[0], 0.0f),
+            glm::vec4(rmat[1], 0.0f), glm::vec4(rmat[2], 0.0f),
+            glm::vec4(world_position, 1.0f)), world_position);
+      }
+    }
   }
 }
 
+void Bvh::calculate_transform(const float* data,
+    const Channel_program& program, Span<const Joint::Channel> channels,
+    const glm::mat4& offmat, const glm::mat4* parent_ltm, glm::mat4& ltm,
+    glm::vec3& pos) {
+  Matrix_channels local;
+  program.apply(data, channels, local);
+
+  glm::mat4 world; // transformation of parent and offset
+
+  if (parent_ltm)
+    world = *parent_ltm * offmat;
+  else
+    world = local.tmat * offmat;
+
+  ltm = world * local.rmat;
+  pos = world[3];
+}
+
 }
@@ -0,0 +1,140 @@
+#include "clip-cache.h"
+
+#include "bvh-parser.h"
+#include "easylogging++.h"
+
+#include <exception>
+#include <iterator>
+
+namespace bvh {
+
+Clip_cache::Clip_cache(std::size_t budget, const Loader& loader)
+    : budget_(budget), loader_(loader), used_(0), last_id_(0) {
+  if (!loader_) {
+    loader_ = [](const bf::path& path, Bvh* bvh) {
+      return Bvh_parser().parse(path, bvh);
+    };
+  }
+}
+
+int Clip_cache::get(const bf::path& path, std::shared_ptr <const Bvh>& clip) {
+  boost::system::error_code error;
+  bf::path canonical = bf::canonical(path, error);
+  std::time_t time = error ? 0 : bf::last_write_time(canonical, error);
+  if (error) {
+    LOG(ERROR) << "Cannot find clip : " << path;
+    return -1;
+  }
+
+  const std::string key = canonical.string();
+  std::promise <std::shared_ptr <const Bvh>> promise;
+  std::shared_future <std::shared_ptr <const Bvh>> future;
+  std::uint64_t id = 0;
+
+  //############################################################################
+  // Finding clip or registering it as being loaded by this thread
+  //############################################################################
+  {
+    std::lock_guard <std::mutex> lock(mutex_);
+    auto found = entries_.find(key);
+
+    if (found != entries_.end() && found->second.time == time) {
+      lru_.splice(lru_.begin(), lru_, found->second.lru);
+      future = found->second.clip;
+    } else {
+      if (found != entries_.end())
+        remove(found);
+
+      id = ++last_id_;
+      future = promise.get_future().share();
+      lru_.push_front(key);
+      entries_[key] = Entry{time, future, 0, false, lru_.begin(), id};
+    }
+  }
+
+  //############################################################################
+  // Loading clip, other threads asking for it wait for the result
+  //############################################################################
+  if (id) {
+    // Exception is turned into failed loading, so waiting threads are not
+    // left with broken promise and the entry is removed
+    std::shared_ptr <Bvh> loaded;
+    try {
+      loaded = std::make_shared<Bvh>();
+      if (loader_(canonical, loaded.get())) {
+        LOG(ERROR) << "Cannot load clip : " << path;
+        loaded.reset();
+      }
+    } catch (const std::exception& exception) {
+      LOG(ERROR) << "Cannot load clip : " << path << ", " << exception.what();
+      loaded.reset();
+    } catch (...) {
+      LOG(ERROR) << "Cannot load clip : " << path;
+      loaded.reset();
+    }
+
+    std::size_t bytes = loaded ? loaded->memory_size() : 0;
+    promise.set_value(loaded);
+
+    std::lock_guard <std::mutex> lock(mutex_);
+    auto found = entries_.find(key);
+
+    // Entry could be replaced by newer version of file in the meantime
+    if (found != entries_.end() && found->second.id == id) {
+      if (!loaded) {
+        remove(found);
+      } else {
+        found->second.bytes = bytes;
+        found->second.loaded = true;
+        used_ += bytes;
+        evict();
+      }
+    }
+  }
+
+  clip = future.get();
+  return clip ? 0 : -1;
+}
+
+void Clip_cache::clear() {
+  std::lock_guard <std::mutex> lock(mutex_);
+
+  for (auto entry = entries_.begin(); entry != entries_.end();) {
+    auto next = std::next(entry);
+    if (entry->second.loaded)
+      remove(entry);
+    entry = next;
+  }
+}
+
+std::size_t Clip_cache::memory_size() const {
+  std::lock_guard <std::mutex> lock(mutex_);
+  return used_;
+}
+
+unsigned Clip_cache::num_clips() const {
+  std::lock_guard <std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+void Clip_cache::remove(std::unordered_map <std::string, Entry>::iterator
+    entry) {
+  if (entry->second.loaded)
+    used_ -= entry->second.bytes;
+  lru_.erase(entry->second.lru);
+  entries_.erase(entry);
+}
+
+void Clip_cache::evict() {
+  // Clips being loaded have no size yet, so they are skipped
+  for (auto key = lru_.end(); used_ > budget_ && key != lru_.begin();) {
+    --key;
+    auto entry = entries_.find(*key);
+    if (entry->second.loaded) {
+      key = std::next(key);
+      remove(entry);
+    }
+  }
+}
+
+} // namespace
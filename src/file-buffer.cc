@@ -0,0 +1,39 @@
+#include "file-buffer.h"
+
+#include <boost/filesystem/fstream.hpp>
+#include <ios>
+#include <iterator>
+
+namespace bvh {
+
+int File_buffer::open(const bf::path& path) {
+  boost::system::error_code error;
+
+  // Empty files cannot be mapped, but they are still valid to read
+  if (bf::is_regular_file(path, error) && bf::file_size(path, error) > 0) {
+    try {
+      mapped_file_.open(path);
+      return 0;
+    } catch (const std::ios_base::failure&) {
+      // Fall back to ordinary reading below
+    }
+  }
+
+  bf::ifstream file(path, std::ios_base::in | std::ios_base::binary);
+  if (!file.is_open())
+    return -1;
+
+  content_.assign(std::istreambuf_iterator<char>(file),
+      std::istreambuf_iterator<char>());
+
+  return file.bad() ? -1 : 0;
+}
+
+int File_buffer::open(std::istream& stream) {
+  content_.assign(std::istreambuf_iterator<char>(stream),
+      std::istreambuf_iterator<char>());
+
+  return stream.bad() ? -1 : 0;
+}
+
+} // namespace
@@ -0,0 +1,63 @@
+#include "fk-simd.h"
+
+// This file is compiled with AVX2 enabled, so it must not define or use any
+// inline function shared with other files, only its own local vector type
+#if defined(BVH_PARSER_AVX2)
+#include <immintrin.h>
+
+namespace {
+
+/** Eight floats in AVX register */
+struct Avx_vec {
+  static const unsigned kLanes = 8;
+
+  static Avx_vec set1(float x) { return Avx_vec{_mm256_set1_ps(x)}; }
+  static Avx_vec load(const float* data) {
+    return Avx_vec{_mm256_loadu_ps(data)};
+  }
+  void store(float* data) const { _mm256_storeu_ps(data, value); }
+
+  __m256 value;
+};
+
+Avx_vec operator+(Avx_vec a, Avx_vec b) {
+  return {_mm256_add_ps(a.value, b.value)};
+}
+Avx_vec operator-(Avx_vec a, Avx_vec b) {
+  return {_mm256_sub_ps(a.value, b.value)};
+}
+Avx_vec operator*(Avx_vec a, Avx_vec b) {
+  return {_mm256_mul_ps(a.value, b.value)};
+}
+Avx_vec abs(Avx_vec a) {
+  return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.value)};
+}
+Avx_vec truncate(Avx_vec a) {
+  return {_mm256_round_ps(a.value, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC)};
+}
+Avx_vec less(Avx_vec a, Avx_vec b) {
+  return {_mm256_cmp_ps(a.value, b.value, _CMP_LT_OQ)};
+}
+Avx_vec mask_and(Avx_vec a, Avx_vec b) {
+  return {_mm256_and_ps(a.value, b.value)};
+}
+Avx_vec mask_or(Avx_vec a, Avx_vec b) {
+  return {_mm256_or_ps(a.value, b.value)};
+}
+Avx_vec select(Avx_vec mask, Avx_vec a, Avx_vec b) {
+  return {_mm256_blendv_ps(b.value, a.value, mask.value)};
+}
+
+} // namespace
+
+namespace bvh {
+namespace simd {
+
+void calculate_avx2(const Input& input, unsigned first_frame,
+    unsigned last_frame, float* scratch) {
+  calculate_frames<Avx_vec>(input, first_frame, last_frame, scratch);
+}
+
+} // namespace
+} // namespace
+#endif
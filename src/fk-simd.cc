@@ -0,0 +1,127 @@
+#include "fk-simd.h"
+
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BVH_PARSER_SSE
+#endif
+
+namespace {
+
+//##############################################################################
+// Scalar fallback, single lane
+//##############################################################################
+
+/** Comparison result of single lane */
+struct Scalar_mask {
+  bool value;
+};
+
+/** Single float with interface of SIMD vector */
+struct Scalar_vec {
+  static const unsigned kLanes = 1;
+
+  static Scalar_vec set1(float x) { return Scalar_vec{x}; }
+  static Scalar_vec load(const float* data) { return Scalar_vec{*data}; }
+  void store(float* data) const { *data = value; }
+
+  float value;
+};
+
+Scalar_vec operator+(Scalar_vec a, Scalar_vec b) { return {a.value + b.value}; }
+Scalar_vec operator-(Scalar_vec a, Scalar_vec b) { return {a.value - b.value}; }
+Scalar_vec operator*(Scalar_vec a, Scalar_vec b) { return {a.value * b.value}; }
+Scalar_vec abs(Scalar_vec a) { return {std::fabs(a.value)}; }
+Scalar_vec truncate(Scalar_vec a) { return {std::trunc(a.value)}; }
+Scalar_mask less(Scalar_vec a, Scalar_vec b) { return {a.value < b.value}; }
+Scalar_mask mask_and(Scalar_mask a, Scalar_mask b) {
+  return {a.value && b.value};
+}
+Scalar_mask mask_or(Scalar_mask a, Scalar_mask b) {
+  return {a.value || b.value};
+}
+Scalar_vec select(Scalar_mask mask, Scalar_vec a, Scalar_vec b) {
+  return mask.value ? a : b;
+}
+
+#ifdef BVH_PARSER_SSE
+//##############################################################################
+// SSE2, four lanes
+//##############################################################################
+
+/** Four floats in SSE register */
+struct Sse_vec {
+  static const unsigned kLanes = 4;
+
+  static Sse_vec set1(float x) { return Sse_vec{_mm_set1_ps(x)}; }
+  static Sse_vec load(const float* data) { return Sse_vec{_mm_loadu_ps(data)}; }
+  void store(float* data) const { _mm_storeu_ps(data, value); }
+
+  __m128 value;
+};
+
+Sse_vec operator+(Sse_vec a, Sse_vec b) { return {_mm_add_ps(a.value, b.value)}; }
+Sse_vec operator-(Sse_vec a, Sse_vec b) { return {_mm_sub_ps(a.value, b.value)}; }
+Sse_vec operator*(Sse_vec a, Sse_vec b) { return {_mm_mul_ps(a.value, b.value)}; }
+Sse_vec abs(Sse_vec a) { return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.value)}; }
+Sse_vec truncate(Sse_vec a) {
+  return {_mm_cvtepi32_ps(_mm_cvttps_epi32(a.value))};
+}
+Sse_vec less(Sse_vec a, Sse_vec b) { return {_mm_cmplt_ps(a.value, b.value)}; }
+Sse_vec mask_and(Sse_vec a, Sse_vec b) { return {_mm_and_ps(a.value, b.value)}; }
+Sse_vec mask_or(Sse_vec a, Sse_vec b) { return {_mm_or_ps(a.value, b.value)}; }
+Sse_vec select(Sse_vec mask, Sse_vec a, Sse_vec b) {
+  return {_mm_or_ps(_mm_and_ps(mask.value, a.value),
+      _mm_andnot_ps(mask.value, b.value))};
+}
+#endif
+
+} // namespace
+
+namespace bvh {
+namespace simd {
+
+Instruction_set instruction_set() {
+#if defined(BVH_PARSER_AVX2)
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2)
+    return Instruction_set::AVX2;
+#endif
+#if defined(BVH_PARSER_SSE)
+  return Instruction_set::SSE;
+#else
+  return Instruction_set::SCALAR;
+#endif
+}
+
+void calculate(const Input& input, unsigned first_frame, unsigned last_frame) {
+  // Scratch of every thread only grows, so frame ranges calculated by the
+  // same worker do not allocate
+  thread_local std::vector <float> scratch;
+  std::size_t scratch_size = static_cast<std::size_t>(
+      input.last_joint - input.first_joint) * kScratchPerJoint;
+  if (scratch.size() < scratch_size)
+    scratch.resize(scratch_size);
+
+  switch (instruction_set()) {
+#if defined(BVH_PARSER_AVX2)
+    case Instruction_set::AVX2:
+      calculate_avx2(input, first_frame, last_frame, scratch.data());
+      break;
+#endif
+#if defined(BVH_PARSER_SSE)
+    case Instruction_set::SSE:
+      calculate_frames<Sse_vec>(input, first_frame, last_frame,
+          scratch.data());
+      break;
+#endif
+    default:
+      calculate_frames<Scalar_vec>(input, first_frame, last_frame,
+          scratch.data());
+  }
+}
+
+} // namespace
+} // namespace
@@ -0,0 +1,159 @@
+#include "frame-index.h"
+
+#include "tokenizer.h"
+
+#include <boost/filesystem/fstream.hpp>
+#include <cstring>
+#include <ios>
+
+namespace {
+
+/** Identifier at the beginning of every index file, with format version */
+const char kMagic[8] = {'B', 'V', 'H', 'I', 'D', 'X', '0', '2'};
+
+/** Value stored in native byte order after identifier, it is read as other
+ *  value on processor with other byte order */
+const std::uint32_t kByteOrderMark = 0x01020304;
+
+/** A struct that keep header of index file, followed by blocks positions */
+struct Header {
+  char magic[8];
+  std::uint32_t byte_order_mark;
+  std::uint32_t reserved;
+  std::uint64_t file_size;
+  std::int64_t file_time;
+  std::uint64_t motion_offset;
+  std::uint32_t num_frames;
+  std::uint32_t num_channels;
+  std::uint32_t frames_per_block;
+  std::uint32_t num_blocks;
+};
+
+/** Gets the number of blocks needed for frames
+ *  @param  num_frames  The number of frames
+ *  @return  The number of blocks
+ */
+unsigned count_blocks(unsigned num_frames) {
+  return (num_frames + bvh::Frame_index::kFramesPerBlock - 1) /
+      bvh::Frame_index::kFramesPerBlock;
+}
+
+}
+
+namespace bvh {
+
+const unsigned Frame_index::kFramesPerBlock;
+
+int Frame_index::build(const char* content, std::size_t size,
+    std::size_t motion_offset, unsigned num_frames, unsigned num_channels) {
+  file_size_ = size;
+  motion_offset_ = motion_offset;
+  num_frames_ = num_frames;
+  num_channels_ = num_channels;
+  offsets_.clear();
+  offsets_.reserve(count_blocks(num_frames));
+
+  Tokenizer tokenizer(content + motion_offset, content + size);
+  boost::string_view token;
+
+  for (unsigned frame = 0; frame < num_frames; frame++) {
+    if (frame % kFramesPerBlock == 0) {
+      tokenizer.good();  // Skipping whitespace before block
+      offsets_.push_back(tokenizer.position() - content);
+    }
+
+    for (unsigned channel = 0; channel < num_channels; channel++) {
+      if (!tokenizer.next(token)) {
+        offsets_.clear();
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+int Frame_index::save(const bf::path& path, std::time_t file_time) const {
+  Header header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.byte_order_mark = kByteOrderMark;
+  header.reserved = 0;
+  header.file_size = file_size_;
+  header.file_time = file_time;
+  header.motion_offset = motion_offset_;
+  header.num_frames = num_frames_;
+  header.num_channels = num_channels_;
+  header.frames_per_block = kFramesPerBlock;
+  header.num_blocks = offsets_.size();
+
+  // Renaming is atomic, so readers see whole index or nothing
+  bf::path temporary = path.parent_path() / bf::unique_path(
+      path.filename().string() + ".%%%%-%%%%-%%%%");
+  boost::system::error_code error;
+
+  {
+    bf::ofstream file(temporary, std::ios_base::out | std::ios_base::binary |
+        std::ios_base::trunc);
+    if (!file.is_open())
+      return -1;
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(offsets_.data()),
+        offsets_.size() * sizeof(std::uint64_t));
+    file.close();
+
+    if (!file.good()) {
+      bf::remove(temporary, error);
+      return -1;
+    }
+  }
+
+  bf::rename(temporary, path, error);
+  if (error) {
+    bf::remove(temporary, error);
+    return -1;
+  }
+
+  return 0;
+}
+
+int Frame_index::load(const bf::path& path, std::size_t file_size,
+    std::time_t file_time, std::size_t motion_offset, unsigned num_frames,
+    unsigned num_channels) {
+  bf::ifstream file(path, std::ios_base::in | std::ios_base::binary);
+  if (!file.is_open())
+    return -1;
+
+  Header header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.byte_order_mark != kByteOrderMark ||
+      header.file_size != file_size || header.file_time != file_time ||
+      header.motion_offset != motion_offset ||
+      header.num_frames != num_frames ||
+      header.num_channels != num_channels ||
+      header.frames_per_block != kFramesPerBlock ||
+      header.num_blocks != count_blocks(num_frames))
+    return -1;
+
+  std::vector <std::uint64_t> offsets(header.num_blocks);
+  if (!file.read(reinterpret_cast<char*>(offsets.data()),
+      offsets.size() * sizeof(std::uint64_t)))
+    return -1;
+
+  // Blocks have to follow each other inside of motion data
+  for (unsigned i = 0; i < offsets.size(); i++) {
+    if (offsets[i] < (i ? offsets[i - 1] : motion_offset) ||
+        offsets[i] > file_size)
+      return -1;
+  }
+
+  file_size_ = file_size;
+  motion_offset_ = motion_offset;
+  num_frames_ = num_frames;
+  num_channels_ = num_channels;
+  offsets_.swap(offsets);
+  return 0;
+}
+
+} // namespace
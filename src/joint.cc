@@ -0,0 +1,43 @@
+#include "joint.h"
+
+#include "easylogging++.h"
+#include "skeleton.h"
+
+namespace bvh {
+
+const std::vector<std::string> Joint::channel_name_str = {
+  "XPOSITION",
+  "YPOSITION",
+  "ZPOSITION",
+  "ZROTATION",
+  "XROTATION",
+  "YROTATION"
+};
+
+void Joint::set_name(const std::string arg) {
+  name_ = arg;
+  if (skeleton_)
+    skeleton_->set_name(index_, arg);
+}
+
+void Joint::set_offset(const Offset arg) {
+  offset_ = arg;
+  if (skeleton_)
+    skeleton_->set_offset(index_, arg);
+}
+
+int Joint::set_channels_order(const std::vector <Channel>& arg) {
+  if (skeleton_) {
+    if (arg.size() != channels_order_.size()) {
+      LOG(ERROR) << "Cannot change number of channels of joint " << name_
+                 << " added to bvh from " << channels_order_.size()
+                 << " to " << arg.size();
+      return -1;
+    }
+    skeleton_->set_channels_order(index_, arg);
+  }
+  channels_order_ = arg;
+  return 0;
+}
+
+} // namespace
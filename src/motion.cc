@@ -0,0 +1,93 @@
+#include "motion.h"
+
+#include "easylogging++.h"
+#include "file-buffer.h"
+#include "frame-index.h"
+#include "tokenizer.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace bvh {
+
+void Motion::resize(unsigned num_frames, unsigned num_channels) {
+  file_.reset();
+  index_.reset();
+  decoded_.reset();
+  owner_.reset();
+
+  num_frames_ = num_frames;
+  num_channels_ = num_channels;
+  storage_.reset(
+      new float[static_cast<std::size_t>(num_frames) * num_channels]());
+  data_ = storage_.get();
+}
+
+void Motion::set_external(float* data, const std::shared_ptr <void>& owner,
+    unsigned num_frames, unsigned num_channels) {
+  file_.reset();
+  index_.reset();
+  decoded_.reset();
+  storage_.reset();
+
+  num_frames_ = num_frames;
+  num_channels_ = num_channels;
+  data_ = data;
+  owner_ = owner;
+}
+
+void Motion::set_lazy(const std::shared_ptr <const File_buffer>& file,
+    const std::shared_ptr <const Frame_index>& index) {
+  owner_.reset();
+  num_frames_ = index->num_frames();
+  num_channels_ = index->num_channels();
+  storage_.reset(new float[static_cast<std::size_t>(num_frames_) *
+      num_channels_]);
+  data_ = storage_.get();
+  decoded_.reset(new std::once_flag[index->num_blocks()]);
+  file_ = file;
+  index_ = index;
+}
+
+std::size_t Motion::memory_size() const {
+  std::size_t size = sizeof(Motion) +
+      static_cast<std::size_t>(num_frames_) * num_channels_ * sizeof(float);
+  if (file_)
+    size += file_->size() + index_->num_blocks() * sizeof(std::uint64_t);
+  return size;
+}
+
+void Motion::load_blocks(unsigned first_frame, unsigned last_frame) const {
+  last_frame = std::min(last_frame, num_frames_);
+  if (first_frame >= last_frame)
+    return;
+
+  unsigned first_block = first_frame / Frame_index::kFramesPerBlock;
+  unsigned last_block = (last_frame - 1) / Frame_index::kFramesPerBlock;
+
+  for (unsigned block = first_block; block <= last_block; block++) {
+    std::call_once(decoded_[block], [this, block]() {
+      unsigned first = block * Frame_index::kFramesPerBlock;
+      unsigned frames = std::min(Frame_index::kFramesPerBlock,
+          num_frames_ - first);
+      std::size_t size = static_cast<std::size_t>(frames) * num_channels_;
+      float* data = data_ + static_cast<std::size_t>(first) *
+          num_channels_;
+
+      Tokenizer tokenizer(file_->data() + index_->block_begin(block),
+          file_->data() + index_->block_end(block));
+
+      // Values that cannot be decoded are set to zero, as in new matrix
+      for (std::size_t i = 0; i < size; i++) {
+        if (!tokenizer.next(data[i])) {
+          LOG(ERROR) << "Failure while decoding motion data of frame "
+                     << first + i / num_channels_;
+          std::fill(data + i, data + size, 0.0f);
+          break;
+        }
+      }
+    });
+  }
+}
+
+} // namespace
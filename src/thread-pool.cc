@@ -0,0 +1,147 @@
+#include "thread-pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace {
+
+/** Set of tasks started by single parallel_for call */
+struct Task_group {
+  /** Number of not yet finished tasks */
+  std::atomic<unsigned> remaining;
+  std::mutex mutex;
+  /** Condition variable notified when last task finishes */
+  std::condition_variable done;
+};
+
+/** Pool of which current thread is worker, nullptr for other threads */
+thread_local const bvh::Thread_pool* current_pool = nullptr;
+
+/** Index of queue of current worker thread */
+thread_local unsigned current_queue = 0;
+
+} // namespace
+
+namespace bvh {
+
+Thread_pool::Thread_pool(unsigned num_threads)
+    : pending_(0), next_queue_(0), stop_(false) {
+  if (num_threads == 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  for (unsigned i = 0; i < num_threads; i++)
+    queues_.emplace_back(new Queue());
+
+  for (unsigned i = 0; i < num_threads; i++)
+    workers_.emplace_back(&Thread_pool::work, this, i);
+}
+
+Thread_pool::~Thread_pool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  condition_.notify_all();
+
+  for (auto& worker : workers_)
+    worker.join();
+}
+
+void Thread_pool::parallel_for(unsigned count,
+    const std::function<void(unsigned)>& task) {
+  if (count == 0)
+    return;
+
+  auto group = std::make_shared<Task_group>();
+  group->remaining = count;
+
+  auto make_task = [group, &task](unsigned i) {
+    return [group, &task, i]() {
+      task(i);
+      if (--group->remaining == 0) {
+        std::lock_guard<std::mutex> lock(group->mutex);
+        group->done.notify_all();
+      }
+    };
+  };
+
+  //############################################################################
+  // Queueing tasks, nested tasks stay with worker until they are stolen
+  //############################################################################
+  if (current_pool == this) {
+    Queue& queue = *queues_[current_queue];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    for (unsigned i = 0; i < count; i++)
+      queue.tasks.push_back(make_task(i));
+  } else {
+    const unsigned num_queues = queues_.size();
+    for (unsigned q = 0; q < num_queues; q++) {
+      Queue& queue = *queues_[q];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      for (unsigned i = count * q / num_queues;
+          i < count * (q + 1) / num_queues; i++)
+        queue.tasks.push_back(make_task(i));
+    }
+  }
+
+  pending_ += count;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+  }
+  condition_.notify_all();
+
+  // Help workers instead of blocking, so nested calls cannot deadlock
+  std::function<void()> queued;
+  while (group->remaining > 0 && try_pop(queued))
+    queued();
+
+  std::unique_lock<std::mutex> lock(group->mutex);
+  group->done.wait(lock, [&group]() { return group->remaining == 0; });
+}
+
+bool Thread_pool::try_pop(std::function<void()>& task) {
+  const unsigned num_queues = queues_.size();
+  const bool worker = current_pool == this;
+  const unsigned first = worker ? current_queue : next_queue_++ % num_queues;
+
+  for (unsigned i = 0; i < num_queues; i++) {
+    Queue& queue = *queues_[(first + i) % num_queues];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+      continue;
+
+    // Own newest task is the most likely to have its data in cache
+    if (worker && i == 0) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    } else {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+    pending_--;
+    return true;
+  }
+
+  return false;
+}
+
+void Thread_pool::work(unsigned index) {
+  current_pool = this;
+  current_queue = index;
+
+  while (true) {
+    std::function<void()> task;
+    if (try_pop(task)) {
+      task();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stop_)
+      return;
+    condition_.wait(lock, [this]() { return stop_ || pending_ > 0; });
+  }
+}
+
+} // namespace
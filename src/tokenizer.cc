@@ -0,0 +1,321 @@
+#include "tokenizer.h"
+
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <locale.h>
+
+#ifdef __APPLE__
+#include <xlocale.h>
+#endif
+
+namespace {
+
+/** Maximal length of number token that is converted without allocation */
+const std::size_t kMaxNumberLength = 64;
+
+/** Maximal number of significant digits that fits in decimal mantissa */
+const int kMaxMantissaDigits = 19;
+
+/** Maximal mantissa that is exactly representable in double */
+const std::uint64_t kMaxExactMantissa = std::uint64_t(1) << 53;
+
+/** Powers of ten that are exactly representable in double */
+const double kPowersOfTen[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+  1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/** Maximal exponent of exactly representable power of ten */
+const int kMaxExactExponent = 22;
+
+/** Decimal number split into its parts, value = mantissa * 10^exponent */
+struct Decimal {
+  bool negative;
+  std::uint64_t mantissa;
+  int exponent;
+};
+
+/** Splits token into decimal parts
+ *  @details  Accepts numbers in form [+-]digits[.digits][(e|E)[+-]digits]
+ *            which covers everything that bvh exporters emit
+ *  @param  token    The token to be split
+ *  @param  decimal  The output parameter, here will be stored decimal parts
+ *  @return  true if token was split, false if it has other form or too many
+ *           significant digits
+ */
+bool split_decimal(boost::string_view token, Decimal& decimal) {
+  const char* current = token.data();
+  const char* end = token.data() + token.size();
+
+  decimal.negative = false;
+  decimal.mantissa = 0;
+  decimal.exponent = 0;
+
+  if (current != end && (*current == '-' || *current == '+')) {
+    decimal.negative = *current == '-';
+    current++;
+  }
+
+  int digits = 0;
+  int significant_digits = 0;
+
+  for (; current != end && *current >= '0' && *current <= '9'; current++) {
+    if (decimal.mantissa != 0 || *current != '0')
+      significant_digits++;
+    decimal.mantissa = decimal.mantissa * 10 + (*current - '0');
+    digits++;
+  }
+
+  if (current != end && *current == '.') {
+    current++;
+    for (; current != end && *current >= '0' && *current <= '9'; current++) {
+      if (decimal.mantissa != 0 || *current != '0')
+        significant_digits++;
+      decimal.mantissa = decimal.mantissa * 10 + (*current - '0');
+      decimal.exponent--;
+      digits++;
+    }
+  }
+
+  if (digits == 0 || significant_digits > kMaxMantissaDigits)
+    return false;
+
+  if (current != end && (*current == 'e' || *current == 'E')) {
+    current++;
+    bool negative_exponent = false;
+    if (current != end && (*current == '-' || *current == '+')) {
+      negative_exponent = *current == '-';
+      current++;
+    }
+
+    if (current == end)
+      return false;
+
+    int exponent = 0;
+    for (; current != end && *current >= '0' && *current <= '9'; current++) {
+      // Huge exponents are left to the slow path
+      if (exponent > 10000)
+        return false;
+      exponent = exponent * 10 + (*current - '0');
+    }
+
+    decimal.exponent += negative_exponent ? -exponent : exponent;
+  }
+
+  return current == end;
+}
+
+/** Converts decimal to double if it can be done exactly with one operation
+ *  @details  Both mantissa and power of ten are exact in double, so the
+ *            single multiplication or division is correctly rounded
+ *  @param  decimal  The decimal to be converted
+ *  @param  number   The output parameter, here will be stored converted number
+ *  @return  true if number was converted, false otherwise
+ */
+bool fast_decimal_to_double(const Decimal& decimal, double& number) {
+  if (decimal.mantissa == 0) {
+    number = decimal.negative ? -0.0 : 0.0;
+    return true;
+  }
+
+  if (decimal.mantissa > kMaxExactMantissa ||
+      decimal.exponent < -kMaxExactExponent ||
+      decimal.exponent > kMaxExactExponent)
+    return false;
+
+  number = static_cast<double>(decimal.mantissa);
+  if (decimal.exponent < 0)
+    number /= kPowersOfTen[-decimal.exponent];
+  else
+    number *= kPowersOfTen[decimal.exponent];
+
+  if (decimal.negative)
+    number = -number;
+
+  return true;
+}
+
+/** Converts decimal to float
+ *  @details  Number is first correctly rounded to double. Every midpoint
+ *            between two floats is exact in double, so rounding that double
+ *            to float gives correctly rounded float unless it lies exactly
+ *            on such midpoint, which is reported as failure.
+ *  @param  decimal  The decimal to be converted
+ *  @param  number   The output parameter, here will be stored converted number
+ *  @return  true if number was converted, false otherwise
+ */
+bool fast_decimal_to_float(const Decimal& decimal, float& number) {
+  double exact;
+  if (!fast_decimal_to_double(decimal, exact))
+    return false;
+
+  float rounded = static_cast<float>(exact);
+  if (std::isinf(rounded) ||
+      (rounded != 0.0f && std::fabs(rounded) <
+      std::numeric_limits<float>::min()))
+    return false;
+
+  if (static_cast<double>(rounded) != exact) {
+    float neighbour = std::nextafter(rounded, exact > rounded ?
+        std::numeric_limits<float>::infinity() :
+        -std::numeric_limits<float>::infinity());
+    double midpoint = (static_cast<double>(rounded) +
+        static_cast<double>(neighbour)) / 2.0;
+    if (midpoint == exact)
+      return false;
+  }
+
+  number = rounded;
+  return true;
+}
+
+#ifdef _WIN32
+/** Type of locale object used by locale specific conversions */
+typedef _locale_t Locale;
+
+/** Gets the "C" locale, used by conversions that cannot depend on locale of
+ *  program
+ *  @return  The "C" locale, created once
+ */
+Locale c_locale() {
+  static const Locale locale = _create_locale(LC_ALL, "C");
+  return locale;
+}
+
+/** Converts string to float number in "C" locale
+ *  @param  str      The null terminated string to be converted
+ *  @param  str_end  The output parameter, here will be stored end of number
+ *  @return  The converted number
+ */
+float strtof_c(const char* str, char** str_end) {
+  return _strtof_l(str, str_end, c_locale());
+}
+
+/** Converts string to double number in "C" locale
+ *  @param  str      The null terminated string to be converted
+ *  @param  str_end  The output parameter, here will be stored end of number
+ *  @return  The converted number
+ */
+double strtod_c(const char* str, char** str_end) {
+  return _strtod_l(str, str_end, c_locale());
+}
+#else
+/** Type of locale object used by locale specific conversions */
+typedef locale_t Locale;
+
+/** Gets the "C" locale, used by conversions that cannot depend on locale of
+ *  program
+ *  @return  The "C" locale, created once
+ */
+Locale c_locale() {
+  static const Locale locale = newlocale(LC_ALL_MASK, "C", Locale());
+  return locale;
+}
+
+/** Converts string to float number in "C" locale
+ *  @param  str      The null terminated string to be converted
+ *  @param  str_end  The output parameter, here will be stored end of number
+ *  @return  The converted number
+ */
+float strtof_c(const char* str, char** str_end) {
+  return strtof_l(str, str_end, c_locale());
+}
+
+/** Converts string to double number in "C" locale
+ *  @param  str      The null terminated string to be converted
+ *  @param  str_end  The output parameter, here will be stored end of number
+ *  @return  The converted number
+ */
+double strtod_c(const char* str, char** str_end) {
+  return strtod_l(str, str_end, c_locale());
+}
+#endif
+
+/** Converts whole token to number with C conversion function
+ *  @param  token    The token to be converted
+ *  @param  convert  The conversion function, ex. std::strtof
+ *  @param  number   The output parameter, here will be stored converted number
+ *  @return  true if whole token was converted, false otherwise
+ */
+template <typename T, typename Convert>
+bool convert_token(boost::string_view token, Convert convert, T& number) {
+  // Mapped content is not null terminated so token has to be copied
+  char buffer[kMaxNumberLength + 1];
+  std::string long_token;
+  const char* str = buffer;
+
+  if (token.size() <= kMaxNumberLength) {
+    std::memcpy(buffer, token.data(), token.size());
+    buffer[token.size()] = '\0';
+  } else {
+    long_token = token.to_string();
+    str = long_token.c_str();
+  }
+
+  char* str_end;
+  number = convert(str, &str_end);
+  return str_end != str && str_end == str + token.size();
+}
+
+} // namespace
+
+namespace bvh {
+
+bool Tokenizer::next(float& number) {
+  boost::string_view token;
+  if (!next(token))
+    return false;
+
+  return to_float(token, number);
+}
+
+bool Tokenizer::next(double& number) {
+  boost::string_view token;
+  if (!next(token))
+    return false;
+
+  return to_double(token, number);
+}
+
+bool Tokenizer::next(int& number) {
+  boost::string_view token;
+  if (!next(token))
+    return false;
+
+  // Values out of int range are rejected instead of being wrapped
+  long value;
+  errno = 0;
+  if (!convert_token(token, [](const char* str, char** str_end) {
+    return std::strtol(str, str_end, 10);
+  }, value) || errno == ERANGE || value < INT_MIN || value > INT_MAX)
+    return false;
+
+  number = static_cast<int>(value);
+  return true;
+}
+
+bool Tokenizer::to_float(boost::string_view token, float& number) {
+  Decimal decimal;
+  if (split_decimal(token, decimal) && fast_decimal_to_float(decimal, number))
+    return true;
+
+  // Rare forms (too many digits, huge exponents, inf, nan) use C library,
+  // with "C" locale, so decimal separator is always '.'
+  return convert_token(token, strtof_c, number);
+}
+
+bool Tokenizer::to_double(boost::string_view token, double& number) {
+  Decimal decimal;
+  if (split_decimal(token, decimal) &&
+      fast_decimal_to_double(decimal, number))
+    return true;
+
+  return convert_token(token, strtod_c, number);
+}
+
+} // namespace
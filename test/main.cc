@@ -1,14 +1,35 @@
 #include "gtest/gtest.h"
 
+#include "bvh-binary.h"
 #include "bvh-parser.h"
+#include "channel-program.h"
+#include "clip-cache.h"
 #include "config.h"
 #include "easylogging++.h"
+#include "frame-index.h"
+#include "tokenizer.h"
 #include "utils.h"
 
 #include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <clocale>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
 #define DEBUG true
 
@@ -26,6 +47,97 @@ int main(int argc, char **argv) {
   return RUN_ALL_TESTS();
 }
 
+/** Checks that transforms of all joints match within documented tolerance,
+ *  1e-5 for rotation part and 1e-5 relative to distance from origin for
+ *  positions
+ */
+void expect_near_transforms(const bvh::Bvh& expected, const bvh::Bvh& data) {
+  for (int i = 0; i < data.joints().size(); i++) {
+    for (int frame = 0; frame < data.num_frames(); frame++) {
+      const glm::mat4& expected_ltm = expected.joints()[i]->ltm(frame);
+      const glm::mat4& ltm = data.joints()[i]->ltm(frame);
+      const glm::vec3& expected_pos = expected.joints()[i]->pos(frame);
+      const glm::vec3& pos = data.joints()[i]->pos(frame);
+      float distance = std::sqrt(expected_pos.x * expected_pos.x +
+          expected_pos.y * expected_pos.y + expected_pos.z * expected_pos.z);
+
+      for (int col = 0; col < 3; col++)
+        for (int row = 0; row < 4; row++)
+          ASSERT_NEAR(expected_ltm[col][row], ltm[col][row], 1e-5);
+      for (int k = 0; k < 3; k++) {
+        ASSERT_NEAR(expected_pos[k], pos[k], 1e-5 * std::max(1.0f, distance));
+        ASSERT_NEAR(expected_ltm[3][k], ltm[3][k],
+            1e-5 * std::max(1.0f, distance));
+      }
+      ASSERT_EQ(expected_ltm[3][3], ltm[3][3]);
+    }
+  }
+}
+
+/** Joint read by reference parser */
+struct Reference_joint {
+  std::string name;
+  float offset[3];
+  unsigned num_channels;
+};
+
+/** Parses file reading tokens from std::ifstream, as parser did before
+ *  memory mapped tokenizer, to have independent result to compare with
+ */
+void parse_reference(const bf::path& path,
+    std::vector<Reference_joint>& joints, std::vector<float>& values) {
+  bf::ifstream file(path);
+  std::string token;
+
+  while (file >> token && token != "Time:") {
+    if (token == "ROOT" || token == "JOINT") {
+      Reference_joint joint;
+      file >> joint.name >> token >> token;  // Consuming "{ OFFSET"
+      file >> joint.offset[0] >> joint.offset[1] >> joint.offset[2];
+      file >> token >> joint.num_channels;  // Consuming "CHANNELS"
+      for (unsigned i = 0; i < joint.num_channels; i++)
+        file >> token;
+      joints.push_back(joint);
+    } else if (token == "End") {
+      Reference_joint joint = {"End Site", {0.0f, 0.0f, 0.0f}, 0};
+      file >> token >> token >> token;  // Consuming "Site { OFFSET"
+      file >> joint.offset[0] >> joint.offset[1] >> joint.offset[2];
+      joints.push_back(joint);
+    }
+  }
+
+  float value;
+  file >> value;  // Frame time
+  while (file >> value)
+    values.push_back(value);
+}
+
+TEST(ExampleFileTest, StreamParserEquivalenceTest) {
+  for (const char* name : {"example.bvh", "simple.bvh", "walk_01.bvh"}) {
+    bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / name;
+    std::vector<Reference_joint> joints;
+    std::vector<float> values;
+    parse_reference(sample_path, joints, values);
+
+    bvh::Bvh_parser parser;
+    bvh::Bvh data;
+    ASSERT_EQ(0, parser.parse(sample_path, &data));
+    ASSERT_EQ(joints.size(), data.joints().size());
+
+    for (unsigned i = 0; i < joints.size(); i++) {
+      const bvh::Joint& joint = *data.joints()[i];
+      ASSERT_EQ(joints[i].name, joint.name());
+      ASSERT_EQ(joints[i].offset[0], joint.offset().x);
+      ASSERT_EQ(joints[i].offset[1], joint.offset().y);
+      ASSERT_EQ(joints[i].offset[2], joint.offset().z);
+      ASSERT_EQ(joints[i].num_channels, joint.num_channels());
+    }
+
+    ASSERT_EQ(values.size(), data.num_frames() * data.num_channels());
+    ASSERT_EQ(values, data.motion().data().to_vector());
+  }
+}
+
 TEST(ExampleFileTest, ParseTest) {
   bvh::Bvh_parser parser;
   bvh::Bvh data;
@@ -56,3 +168,1063 @@ TEST(ExampleFileTest, MotionCalculationTest) {
 #endif
 
 }
+
+TEST(ExampleFileTest, MissingFileTest) {
+  bvh::Bvh_parser parser;
+  bvh::Bvh data;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "missing.bvh";
+  ASSERT_EQ(-1, parser.parse(sample_path, &data));
+  ASSERT_EQ(nullptr, data.root_joint());
+}
+
+TEST(TokenizerTest, FloatDecodingTest) {
+  const char* numbers[] = {"-0.00000", "0", "+1.5", ".5", "5.", "-164.35",
+      "1e10", "1E-5", "-2.5e+3", "3.4028235e38", "1e-45", "16777217",
+      "0.1000000000000000000000000001", "nan", "inf"};
+
+  for (const char* number : numbers) {
+    float expected = std::strtof(number, nullptr);
+    float decoded;
+    ASSERT_TRUE(bvh::Tokenizer::to_float(number, decoded)) << number;
+    ASSERT_EQ(0, std::memcmp(&expected, &decoded, sizeof(float))) << number;
+  }
+
+  // Nine significant digits are enough to decode exactly the same float
+  char buffer[32];
+  for (float value = -1000.0f; value < 1000.0f; value += 0.0123f) {
+    std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+    float decoded;
+    ASSERT_TRUE(bvh::Tokenizer::to_float(buffer, decoded));
+    ASSERT_EQ(value, decoded) << buffer;
+  }
+
+  float decoded;
+  ASSERT_FALSE(bvh::Tokenizer::to_float("1.5x", decoded));
+  ASSERT_FALSE(bvh::Tokenizer::to_float("-", decoded));
+}
+
+TEST(TokenizerTest, IntegerDecodingTest) {
+  const char content[] = "344 -12 2147483647 2147483648 99999999999 12x";
+  bvh::Tokenizer tokenizer(content, content + sizeof(content) - 1);
+  int number;
+
+  ASSERT_TRUE(tokenizer.next(number));
+  ASSERT_EQ(344, number);
+  ASSERT_TRUE(tokenizer.next(number));
+  ASSERT_EQ(-12, number);
+  ASSERT_TRUE(tokenizer.next(number));
+  ASSERT_EQ(2147483647, number);
+
+  // Numbers out of int range are not wrapped
+  ASSERT_FALSE(tokenizer.next(number));
+  ASSERT_FALSE(tokenizer.next(number));
+  ASSERT_FALSE(tokenizer.next(number));
+}
+
+TEST(TokenizerTest, LocaleIndependentDecodingTest) {
+  const char* locales[] = {"pl_PL.UTF-8", "de_DE.UTF-8", "fr_FR.UTF-8"};
+  std::string previous = std::setlocale(LC_NUMERIC, nullptr);
+  bool changed = false;
+  for (const char* locale : locales)
+    changed = changed || std::setlocale(LC_NUMERIC, locale) != nullptr;
+  if (!changed)
+    GTEST_SKIP() << "No locale with ',' decimal separator is installed";
+
+  // Numbers too long or too large for fast decoder are converted by fallback
+  float decoded_float;
+  double decoded_double;
+  bool float_ok = bvh::Tokenizer::to_float(
+      "0.1000000000000000000000000001", decoded_float);
+  bool double_ok = bvh::Tokenizer::to_double("1.5e300", decoded_double);
+  std::setlocale(LC_NUMERIC, previous.c_str());
+
+  ASSERT_TRUE(float_ok);
+  ASSERT_EQ(0.1f, decoded_float);
+  ASSERT_TRUE(double_ok);
+  ASSERT_EQ(1.5e300, decoded_double);
+}
+
+TEST(ExampleFileTest, ParallelParseTest) {
+  bvh::Bvh_parser parser;
+  bvh::Bvh expected;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh";
+  ASSERT_EQ(0, parser.parse(sample_path, &expected));
+
+  parser.set_thread_pool(std::make_shared<bvh::Thread_pool>(4));
+  bvh::Bvh data;
+  ASSERT_EQ(0, parser.parse(sample_path, &data));
+
+  ASSERT_EQ(expected.num_frames(), data.num_frames());
+  ASSERT_EQ(expected.joints().size(), data.joints().size());
+  for (int i = 0; i < data.joints().size(); i++) {
+    ASSERT_EQ(expected.joints()[i]->channel_data(),
+        data.joints()[i]->channel_data());
+  }
+}
+
+TEST(ExampleFileTest, MotionMatrixTest) {
+  bvh::Bvh_parser parser;
+  bvh::Bvh data;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "example.bvh";
+  ASSERT_EQ(0, parser.parse(sample_path, &data));
+
+  const bvh::Motion& motion = data.motion();
+  ASSERT_EQ(data.num_frames(), motion.num_frames());
+  ASSERT_EQ(data.num_channels(), motion.num_channels());
+  ASSERT_EQ(motion.num_frames() * motion.num_channels(), motion.data().size());
+
+  unsigned channel_offset = 0;
+  for (auto& joint : data.joints()) {
+    ASSERT_EQ(channel_offset, joint->channel_offset());
+    for (unsigned frame = 0; frame < data.num_frames(); frame++) {
+      bvh::Span<const float> frame_data = joint->channel_data(frame);
+      ASSERT_EQ(joint->num_channels(), frame_data.size());
+      for (unsigned channel = 0; channel < joint->num_channels(); channel++) {
+        ASSERT_EQ(motion.frame(frame)[channel_offset + channel],
+            joint->channel_data(frame, channel));
+      }
+    }
+    channel_offset += joint->num_channels();
+  }
+}
+
+TEST(JointTest, StandaloneJointTest) {
+  bvh::Joint joint;
+  ASSERT_TRUE(joint.channel_data().empty());
+  ASSERT_EQ(0, joint.channel_data(0).size());
+  ASSERT_EQ(0.0f, joint.channel_data(0, 0));
+
+  // Joint that is not added to bvh keeps channels data in its own matrix
+  joint.set_channels_order({bvh::Joint::Channel::ZROTATION,
+      bvh::Joint::Channel::XROTATION, bvh::Joint::Channel::YROTATION});
+  std::vector<std::vector<float>> channels = {{1, 2, 3}, {4, 5, 6}};
+  joint.set_channel_data(channels);
+  ASSERT_EQ(channels, joint.channel_data());
+  ASSERT_EQ(5.0f, joint.channel_data(1, 1));
+  ASSERT_EQ(0, joint.channel_data(2).size());
+}
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#endif
+TEST(JointTest, AddFrameMotionDataTest) {
+  // Standalone joint grows its own matrix
+  bvh::Joint joint;
+  joint.set_channels_order({bvh::Joint::Channel::ZROTATION,
+      bvh::Joint::Channel::XROTATION});
+  joint.add_frame_motion_data({1, 2});
+  joint.add_frame_motion_data({3, 4});
+  std::vector<std::vector<float>> channels = {{1, 2}, {3, 4}};
+  ASSERT_EQ(channels, joint.channel_data());
+
+  // Joint of bvh writes frames of its matrix one after another
+  bvh::Bvh_parser parser;
+  bvh::Bvh data;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "example.bvh";
+  ASSERT_EQ(0, parser.parse(sample_path, &data));
+  std::shared_ptr<bvh::Joint> added = data.joints()[1];
+  std::vector<float> first(added->num_channels(), 1.0f);
+  std::vector<float> second(added->num_channels(), 2.0f);
+  added->add_frame_motion_data(first);
+  added->add_frame_motion_data(second);
+  ASSERT_EQ(first, added->channel_data(0).to_vector());
+  ASSERT_EQ(second, added->channel_data(1).to_vector());
+  ASSERT_EQ(data.motion().frame(0)[added->channel_offset()], 1.0f);
+}
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+TEST(ExampleFileTest, SkeletonTest) {
+  bvh::Bvh_parser parser;
+  std::weak_ptr<bvh::Joint> root_joint;
+
+  {
+    bvh::Bvh data;
+    bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "example.bvh";
+    ASSERT_EQ(0, parser.parse(sample_path, &data));
+    root_joint = data.root_joint();
+
+    const bvh::Skeleton& skeleton = data.skeleton();
+    ASSERT_EQ(data.joints().size(), skeleton.num_joints());
+    ASSERT_EQ(data.num_channels(), skeleton.num_channels());
+    ASSERT_EQ(bvh::Skeleton::kNoParent, skeleton.parent(0));
+    ASSERT_EQ(skeleton.num_joints(), skeleton.subtree_end(0));
+
+    for (unsigned i = 0; i < skeleton.num_joints(); i++) {
+      std::shared_ptr<bvh::Joint> joint = data.joints()[i];
+      ASSERT_EQ(i, joint->index());
+      ASSERT_EQ(joint->name(), skeleton.name(i));
+      ASSERT_EQ(joint->channel_offset(), skeleton.channel_offset(i));
+      ASSERT_EQ(joint->channels_order(),
+          skeleton.channels_order(i).to_vector());
+
+      std::vector<std::shared_ptr<bvh::Joint>> children;
+      for (unsigned c = i + 1; c < skeleton.subtree_end(i);
+          c = skeleton.subtree_end(c)) {
+        ASSERT_EQ(static_cast<int>(i), skeleton.parent(c));
+        children.push_back(data.joints()[c]);
+      }
+      ASSERT_EQ(joint->children(), children);
+    }
+  }
+
+  // Joints do not keep each other alive, so whole hierarchy is released
+  ASSERT_TRUE(root_joint.expired());
+}
+
+TEST(ExampleFileTest, JointChangeAfterParseTest) {
+  bvh::Bvh_parser parser;
+  bvh::Bvh data;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "simple.bvh";
+  ASSERT_EQ(0, parser.parse(sample_path, &data));
+  data.recalculate_joints_ltm();
+  glm::vec3 before = data.joints()[1]->pos(0);
+
+  // Changes made through joint are used by next calculation
+  bvh::Joint& joint = *data.joints()[1];
+  bvh::Joint::Offset offset = joint.offset();
+  offset.x += 100.0f;
+  joint.set_offset(offset);
+  joint.set_name("Moved");
+  ASSERT_EQ(offset.x, data.skeleton().offset(1).x);
+  ASSERT_EQ("Moved", data.skeleton().name(1));
+
+  std::vector<bvh::Joint::Channel> order = joint.channels_order();
+  std::reverse(order.begin(), order.end());
+  ASSERT_EQ(0, joint.set_channels_order(order));
+  ASSERT_EQ(order, data.skeleton().channels_order(1).to_vector());
+
+  // Number of channels of joint added to bvh cannot change
+  ASSERT_EQ(-1, joint.set_channels_order({bvh::Joint::Channel::XROTATION}));
+  ASSERT_EQ(order, joint.channels_order());
+
+  data.recalculate_joints_ltm();
+  ASSERT_GT(std::fabs(data.joints()[1]->pos(0).x - before.x), 1.0f);
+
+  std::vector<glm::mat4> pose(data.joints().size());
+  std::vector<glm::vec3> positions(data.joints().size());
+  ASSERT_EQ(0, data.calculate_pose(0, pose.data(), positions.data()));
+  ASSERT_EQ(data.joints()[1]->pos(0), positions[1]);
+
+  bvh::Bvh simd;
+  ASSERT_EQ(0, parser.parse(sample_path, &simd));
+  simd.joints()[1]->set_offset(offset);
+  simd.joints()[1]->set_channels_order(order);
+  simd.recalculate_joints_ltm(nullptr, bvh::Bvh::Fk_method::SIMD);
+  for (unsigned i = 0; i < data.joints().size(); i++) {
+    for (int k = 0; k < 3; k++) {
+      ASSERT_NEAR(data.joints()[i]->pos(0)[k], simd.joints()[i]->pos(0)[k],
+          1e-3);
+    }
+  }
+}
+
+TEST(ExampleFileTest, ParallelMotionCalculationTest) {
+  bvh::Bvh_parser parser;
+  bvh::Bvh expected;
+  bvh::Bvh data;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh";
+  ASSERT_EQ(0, parser.parse(sample_path, &expected));
+  ASSERT_EQ(0, parser.parse(sample_path, &data));
+
+  expected.recalculate_joints_ltm();
+  data.set_thread_pool(std::make_shared<bvh::Thread_pool>(4));
+  data.recalculate_joints_ltm();
+
+  for (int i = 0; i < data.joints().size(); i++) {
+    ASSERT_EQ(expected.joints()[i]->ltm(), data.joints()[i]->ltm());
+    ASSERT_EQ(expected.joints()[i]->pos(), data.joints()[i]->pos());
+  }
+}
+
+TEST(ExampleFileTest, SimdMotionCalculationTest) {
+  bvh::Bvh_parser parser;
+  bvh::Bvh expected;
+  bvh::Bvh data;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh";
+  ASSERT_EQ(0, parser.parse(sample_path, &expected));
+  ASSERT_EQ(0, parser.parse(sample_path, &data));
+
+  expected.recalculate_joints_ltm();
+  data.set_thread_pool(std::make_shared<bvh::Thread_pool>(4));
+  data.recalculate_joints_ltm(nullptr, bvh::Bvh::Fk_method::SIMD);
+
+  // Tolerance documented in fk-simd.h
+  expect_near_transforms(expected, data);
+}
+
+TEST(ExampleFileTest, PoseCalculationTest) {
+  bvh::Bvh_parser parser;
+  bvh::Bvh data;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh";
+  ASSERT_EQ(0, parser.parse(sample_path, &data));
+  data.recalculate_joints_ltm();
+
+  const unsigned num_joints = data.joints().size();
+  std::vector<glm::mat4> ltm(2 * num_joints);
+  std::vector<glm::vec3> pos(2 * num_joints);
+
+  ASSERT_EQ(0, data.calculate_pose(data.num_frames() / 2, ltm.data(),
+      pos.data()));
+  for (int i = 0; i < num_joints; i++) {
+    ASSERT_EQ(data.joints()[i]->ltm(data.num_frames() / 2), ltm[i]);
+    ASSERT_EQ(data.joints()[i]->pos(data.num_frames() / 2), pos[i]);
+  }
+
+  const unsigned frames[] = {data.num_frames() - 1, 0};
+  ASSERT_EQ(0, data.calculate_poses(bvh::Span<const unsigned>(frames, 2),
+      ltm.data(), pos.data()));
+  for (int i = 0; i < num_joints; i++) {
+    ASSERT_EQ(data.joints()[i]->ltm(frames[0]), ltm[i]);
+    ASSERT_EQ(data.joints()[i]->pos(frames[1]), pos[num_joints + i]);
+  }
+
+  ASSERT_EQ(-1, data.calculate_pose(data.num_frames(), ltm.data()));
+}
+
+TEST(ExampleFileTest, RepeatedMotionCalculationTest) {
+  bvh::Bvh_parser parser;
+  bvh::Bvh data;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh";
+  ASSERT_EQ(0, parser.parse(sample_path, &data));
+
+  data.recalculate_joints_ltm();
+  std::shared_ptr<bvh::Joint> joint = data.joints().back();
+  const glm::mat4* ltm = joint->ltm().data();
+  const glm::vec3* pos = joint->pos().data();
+
+  data.recalculate_joints_ltm(nullptr, bvh::Bvh::Fk_method::SIMD);
+  data.recalculate_joints_ltm();
+
+  // Storage is overwritten in place, not appended
+  ASSERT_EQ(data.num_frames(), joint->ltm().size());
+  ASSERT_EQ(data.num_frames(), joint->pos().size());
+  ASSERT_EQ(ltm, joint->ltm().data());
+  ASSERT_EQ(pos, joint->pos().data());
+
+  bvh::Joint single;
+  single.set_ltm(glm::mat4(2.0));
+  single.set_ltm(glm::mat4(3.0));
+  single.set_pos(glm::vec3(1.0), 2);
+  single.set_pos(glm::vec3(4.0), 2);
+  ASSERT_EQ(1, single.ltm().size());
+  ASSERT_EQ(glm::mat4(3.0), single.ltm(0));
+  ASSERT_EQ(3, single.pos().size());
+  ASSERT_EQ(glm::vec3(4.0), single.pos(2));
+}
+
+TEST(ExampleFileTest, AffineMotionCalculationTest) {
+  bvh::Bvh_parser parser;
+  bvh::Bvh expected;
+  bvh::Bvh data;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh";
+  ASSERT_EQ(0, parser.parse(sample_path, &expected));
+  ASSERT_EQ(0, parser.parse(sample_path, &data));
+
+  expected.recalculate_joints_ltm();
+  data.set_transform_storage(bvh::Bvh::Transform_storage::AFFINE);
+  data.recalculate_joints_ltm();
+
+  for (int i = 0; i < data.joints().size(); i++) {
+    const bvh::Joint& joint = *data.joints()[i];
+    ASSERT_TRUE(joint.ltm().empty());
+    ASSERT_TRUE(joint.pos().empty());
+    ASSERT_EQ(data.num_frames(), joint.affine_ltm().size());
+    for (int frame = 0; frame < data.num_frames(); frame++) {
+      ASSERT_EQ(glm::mat4x3(expected.joints()[i]->ltm(frame)),
+          joint.affine_ltm(frame));
+      ASSERT_EQ(expected.joints()[i]->pos(frame), joint.position(frame));
+
+      // Frame accessors build matrix and position from affine storage
+      ASSERT_EQ(expected.joints()[i]->ltm(frame), joint.ltm(frame));
+      ASSERT_EQ(expected.joints()[i]->pos(frame), joint.pos(frame));
+    }
+  }
+
+  // SIMD method writes affine matrices too
+  data.recalculate_joints_ltm(nullptr, bvh::Bvh::Fk_method::SIMD);
+  const glm::vec3 expected_pos = expected.joints().back()->pos(10);
+  const glm::vec3 pos = data.joints().back()->position(10);
+  for (int k = 0; k < 3; k++)
+    ASSERT_NEAR(expected_pos[k], pos[k], 1e-3);
+}
+
+TEST(ExampleFileTest, QuaternionMotionCalculationTest) {
+  bvh::Bvh_parser parser;
+  bvh::Bvh expected;
+  bvh::Bvh data;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh";
+  ASSERT_EQ(0, parser.parse(sample_path, &expected));
+  ASSERT_EQ(0, parser.parse(sample_path, &data));
+
+  expected.recalculate_joints_ltm();
+  data.recalculate_joints_ltm(nullptr, bvh::Bvh::Fk_method::QUATERNION);
+  expect_near_transforms(expected, data);
+
+  // Subtree reads rotation of its parent from stored matrices
+  data.recalculate_joints_ltm();
+  data.recalculate_joints_ltm(data.joints()[2],
+      bvh::Bvh::Fk_method::QUATERNION);
+  expect_near_transforms(expected, data);
+}
+
+TEST(ExampleFileTest, QuaternionStorageTest) {
+  bvh::Bvh_parser parser;
+  bvh::Bvh expected;
+  bvh::Bvh data;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh";
+  ASSERT_EQ(0, parser.parse(sample_path, &expected));
+  ASSERT_EQ(0, parser.parse(sample_path, &data));
+  expected.recalculate_joints_ltm();
+
+  // Only rotations and positions are stored, matrices are built on request
+  data.set_transform_storage(bvh::Bvh::Transform_storage::QUATERNION);
+  data.recalculate_joints_ltm();
+  data.recalculate_joints_ltm(data.joints()[2]);
+
+  for (unsigned i = 0; i < data.joints().size(); i++) {
+    const bvh::Joint& joint = *data.joints()[i];
+    ASSERT_TRUE(joint.ltm().empty());
+    ASSERT_EQ(data.num_frames(), joint.rotation().size());
+
+    for (unsigned frame = 0; frame < data.num_frames(); frame++) {
+      const glm::vec3& expected_pos = expected.joints()[i]->pos(frame);
+      glm::mat4 ltm = joint.transform_matrix(frame);
+      float tolerance = 1e-5f * std::max(1.0f, glm::length(expected_pos));
+
+      for (int col = 0; col < 3; col++) {
+        for (int row = 0; row < 3; row++) {
+          ASSERT_NEAR(expected.joints()[i]->ltm(frame)[col][row],
+              ltm[col][row], 1e-5);
+        }
+      }
+      for (int k = 0; k < 3; k++) {
+        ASSERT_NEAR(expected_pos[k], joint.pos(frame)[k], tolerance);
+        ASSERT_EQ(joint.pos(frame)[k], ltm[3][k]);
+      }
+      ASSERT_EQ(ltm, joint.ltm(frame));
+    }
+  }
+}
+
+/** Transform that records applied channels as text */
+struct Recording_channels {
+  void translate_x(float value) { calls += "tx" + std::to_string(value); }
+  void translate_y(float value) { calls += "ty" + std::to_string(value); }
+  void translate_z(float value) { calls += "tz" + std::to_string(value); }
+  void rotate_x(float value) { calls += "rx" + std::to_string(value); }
+  void rotate_y(float value) { calls += "ry" + std::to_string(value); }
+  void rotate_z(float value) { calls += "rz" + std::to_string(value); }
+  template <bvh::Euler_order Order>
+  void rotate(float first, float second, float third) {
+    const float values[] = {first, second, third};
+    for (int i = 0; i < 3; i++) {
+      if (bvh::euler_channel(Order, i) == bvh::Joint::Channel::XROTATION)
+        rotate_x(values[i]);
+      else if (bvh::euler_channel(Order, i) == bvh::Joint::Channel::YROTATION)
+        rotate_y(values[i]);
+      else
+        rotate_z(values[i]);
+    }
+  }
+
+  std::string calls;
+};
+
+TEST(ChannelProgramTest, KnownOrderTest) {
+  const bvh::Joint::Channel channels[] = {
+    bvh::Joint::Channel::XPOSITION, bvh::Joint::Channel::YPOSITION,
+    bvh::Joint::Channel::ZPOSITION, bvh::Joint::Channel::ZROTATION,
+    bvh::Joint::Channel::XROTATION, bvh::Joint::Channel::YROTATION
+  };
+  const float data[] = {1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f};
+
+  for (int size = 1; size <= 6; size++) {
+    bvh::Span<const bvh::Joint::Channel> order(channels + 6 - size, size);
+    bvh::Channel_program program(order);
+    ASSERT_EQ(size == 3 || size == 6, program.specialized());
+
+    // Specialized and generic programs apply the same channels
+    Recording_channels specialized;
+    Recording_channels generic;
+    program.apply(data, order, specialized);
+    bvh::Channel_program().apply(data, order, generic);
+    ASSERT_EQ(generic.calls, specialized.calls);
+  }
+
+  bvh::Span<const bvh::Joint::Channel> order(channels, 6);
+  Recording_channels recording;
+  bvh::Channel_program program(order);
+  program.apply(data, order, recording);
+  ASSERT_TRUE(program.specialized());
+  ASSERT_EQ("tx1.000000ty2.000000tz3.000000rz4.000000rx5.000000ry6.000000",
+      recording.calls);
+}
+
+/** Checks closed-form rotation matrix against product of single axis
+ *  rotations, including lack of -0.0f in both of them
+ */
+template <bvh::Euler_order Order>
+void expect_euler_matrix(float first, float second, float third) {
+  const glm::mat3 matrix = bvh::euler_matrix<Order>(first, second, third);
+  glm::mat4 expected(1.0);
+  const float angles[] = {first, second, third};
+  for (int i = 0; i < 3; i++) {
+    bvh::Joint::Channel channel = bvh::euler_channel(Order, i);
+    expected = utils::rotate(expected, angles[i],
+        channel == bvh::Joint::Channel::XROTATION ? utils::Axis::X :
+        channel == bvh::Joint::Channel::YROTATION ? utils::Axis::Y :
+        utils::Axis::Z);
+  }
+
+  for (int col = 0; col < 3; col++) {
+    for (int row = 0; row < 3; row++) {
+      ASSERT_NEAR(expected[col][row], matrix[col][row], 1e-6);
+      ASSERT_EQ(std::signbit(expected[col][row] + 0.0f),
+          std::signbit(matrix[col][row]));
+    }
+  }
+}
+
+TEST(EulerTest, ClosedFormMatrixTest) {
+  const float angles[][3] = {
+    {0.0f, 0.0f, 0.0f}, {90.0f, -90.0f, 180.0f}, {-180.0f, 90.0f, 270.0f},
+    {12.5f, -47.25f, 133.0f}, {-359.0f, 0.5f, 89.99f}
+  };
+
+  for (auto& a : angles) {
+    expect_euler_matrix<bvh::Euler_order::XYZ>(a[0], a[1], a[2]);
+    expect_euler_matrix<bvh::Euler_order::XZY>(a[0], a[1], a[2]);
+    expect_euler_matrix<bvh::Euler_order::YXZ>(a[0], a[1], a[2]);
+    expect_euler_matrix<bvh::Euler_order::YZX>(a[0], a[1], a[2]);
+    expect_euler_matrix<bvh::Euler_order::ZXY>(a[0], a[1], a[2]);
+    expect_euler_matrix<bvh::Euler_order::ZYX>(a[0], a[1], a[2]);
+  }
+}
+
+TEST(ExampleFileTest, StreamingParseTest) {
+  bvh::Bvh_parser parser;
+  bvh::Bvh expected;
+  bvh::Bvh data;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh";
+  ASSERT_EQ(0, parser.parse(sample_path, &expected));
+
+  unsigned hierarchies = 0;
+  unsigned frames = 0;
+  bool same = true;
+  ASSERT_EQ(0, parser.parse(sample_path, &data,
+      [&](const bvh::Bvh& bvh) {
+        hierarchies++;
+        return frames == 0 && bvh.joints().size() == expected.joints().size()
+            ? 0 : 1;
+      },
+      [&](unsigned frame, bvh::Span<const float> channels) {
+        same = same && frame == frames && channels.size() ==
+            expected.num_channels() && std::equal(channels.begin(),
+            channels.end(), expected.motion().frame(frame));
+        frames++;
+        return 0;
+      }));
+
+  ASSERT_EQ(1, hierarchies);
+  ASSERT_EQ(expected.num_frames(), frames);
+  ASSERT_TRUE(same);
+  ASSERT_EQ(expected.num_frames(), data.num_frames());
+  ASSERT_EQ(0, data.motion().num_frames());
+
+  // Streamed bvh has no motion data, so it gets no transforms
+  for (auto method : {bvh::Bvh::Fk_method::MATRIX, bvh::Bvh::Fk_method::SIMD,
+      bvh::Bvh::Fk_method::QUATERNION}) {
+    data.recalculate_joints_ltm(nullptr, method);
+    ASSERT_TRUE(data.joints()[1]->ltm().empty());
+  }
+  ASSERT_EQ(0, data.joints()[1]->channel_data(0).size());
+  ASSERT_TRUE(data.joints()[1]->channel_data().empty());
+  std::vector<glm::mat4> pose(data.joints().size());
+  ASSERT_EQ(-1, data.calculate_pose(0, pose.data()));
+
+  bf::path binary_path = bf::temp_directory_path() / bf::unique_path();
+  bvh::Bvh binary;
+  ASSERT_EQ(0, bvh::save_binary(data, binary_path));
+  ASSERT_EQ(0, bvh::load_binary(binary_path, &binary));
+  ASSERT_EQ(data.num_frames(), binary.num_frames());
+  ASSERT_EQ(0, binary.motion().num_frames());
+  bf::remove(binary_path);
+
+  // Callback stops parsing with its value
+  bvh::Bvh stopped;
+  frames = 0;
+  ASSERT_EQ(7, parser.parse(sample_path, &stopped,
+      [](const bvh::Bvh&) { return 0; },
+      [&](unsigned frame, bvh::Span<const float>) {
+        frames++;
+        return frame == 9 ? 7 : 0;
+      }));
+  ASSERT_EQ(10, frames);
+
+  // Empty callbacks continue parsing and reserved values are not returned
+  bvh::Bvh without_hierarchy;
+  bvh::Bvh without_frames;
+  bvh::Bvh reserved;
+  frames = 0;
+  ASSERT_EQ(0, parser.parse(sample_path, &without_hierarchy, nullptr,
+      [&](unsigned, bvh::Span<const float>) {
+        frames++;
+        return 0;
+      }));
+  ASSERT_EQ(expected.num_frames(), frames);
+  ASSERT_EQ(0, parser.parse(sample_path, &without_frames,
+      [](const bvh::Bvh&) { return 0; }, nullptr));
+  ASSERT_EQ(expected.num_frames(), without_frames.num_frames());
+  ASSERT_EQ(1, parser.parse(sample_path, &reserved,
+      [](const bvh::Bvh&) { return -1; }, nullptr));
+}
+
+TEST(ExampleFileTest, LazyParseTest) {
+  bvh::Bvh_parser parser;
+  bvh::Bvh expected;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh";
+  ASSERT_EQ(0, parser.parse(sample_path, &expected));
+  expected.recalculate_joints_ltm();
+
+  // Index is saved next to file, so file is copied to temporary directory
+  bf::path directory = bf::temp_directory_path() / bf::unique_path();
+  bf::create_directories(directory);
+  bf::path lazy_path = directory / "walk_01.bvh";
+  bf::copy_file(sample_path, lazy_path);
+
+  parser.set_load_mode(bvh::Bvh_parser::Load_mode::LAZY);
+  parser.set_save_frame_index(true);
+  bf::path index_path = bvh::Frame_index::index_path(lazy_path);
+
+  for (int i = 0; i < 2; i++) {
+    bvh::Bvh data;
+    ASSERT_EQ(0, parser.parse(lazy_path, &data));
+    ASSERT_TRUE(data.motion().lazy());
+    ASSERT_TRUE(bf::exists(index_path));
+
+    // Index written under temporary name is renamed, nothing else is left
+    ASSERT_EQ(2, std::distance(bf::directory_iterator(directory),
+        bf::directory_iterator()));
+
+    // Index is backdated, so saving it again would change its time
+    std::time_t index_time = bf::last_write_time(lazy_path) - 3600;
+    if (i == 0)
+      bf::last_write_time(index_path, index_time);
+    else
+      ASSERT_EQ(index_time, bf::last_write_time(index_path));
+
+    // Frames from the end are decoded first
+    unsigned last = expected.num_frames() - 1;
+    bvh::Span<const float> channels = data.joints()[1]->channel_data(last);
+    ASSERT_TRUE(std::equal(channels.begin(), channels.end(),
+        expected.joints()[1]->channel_data(last).begin()));
+
+    ASSERT_EQ(expected.motion().data().to_vector(),
+        data.motion().data().to_vector());
+
+    data.recalculate_joints_ltm();
+    for (unsigned j = 0; j < data.joints().size(); j++)
+      ASSERT_EQ(expected.joints()[j]->ltm(), data.joints()[j]->ltm());
+  }
+
+  bf::remove_all(directory);
+}
+
+TEST(ExampleFileTest, PartialParseTest) {
+  bvh::Bvh_parser parser;
+  bvh::Bvh expected;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh";
+  ASSERT_EQ(0, parser.parse(sample_path, &expected));
+
+  const std::vector<std::string> names = {"Hips", "LeftUpLeg", "LeftLeg"};
+  parser.set_frame_range(100, 160);
+  parser.set_joint_filter(names);
+
+  bvh::Bvh data;
+  ASSERT_EQ(0, parser.parse(sample_path, &data));
+  ASSERT_EQ(60, data.num_frames());
+  ASSERT_EQ(expected.joints().size(), data.joints().size());
+  ASSERT_EQ(12, data.num_channels());
+
+  for (unsigned j = 0; j < data.joints().size(); j++) {
+    const bvh::Joint& joint = *data.joints()[j];
+    if (std::find(names.begin(), names.end(), joint.name()) == names.end()) {
+      ASSERT_EQ(0, joint.num_channels());
+      continue;
+    }
+
+    for (unsigned frame = 0; frame < data.num_frames(); frame++) {
+      ASSERT_EQ(expected.joints()[j]->channel_data(frame + 100).to_vector(),
+          joint.channel_data(frame).to_vector());
+    }
+  }
+
+  // Range is clamped to frames of file
+  parser.set_frame_range(300, 1000);
+  parser.set_joint_filter(std::vector<std::string>());
+  bvh::Bvh tail;
+  ASSERT_EQ(0, parser.parse(sample_path, &tail));
+  ASSERT_EQ(expected.num_frames() - 300, tail.num_frames());
+  ASSERT_EQ(expected.num_channels(), tail.num_channels());
+  ASSERT_EQ(expected.joints()[0]->channel_data(300).to_vector(),
+      tail.joints()[0]->channel_data(0).to_vector());
+}
+
+TEST(ExampleFileTest, HierarchyOnlyParseTest) {
+  bvh::Bvh_parser parser;
+  bvh::Bvh expected;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh";
+  ASSERT_EQ(0, parser.parse(sample_path, &expected));
+
+  bvh::Bvh data;
+  parser.set_load_mode(bvh::Bvh_parser::Load_mode::HIERARCHY_ONLY);
+  ASSERT_EQ(0, parser.parse(sample_path, &data));
+
+  ASSERT_EQ(expected.num_frames(), data.num_frames());
+  ASSERT_EQ(expected.frame_time(), data.frame_time());
+  ASSERT_EQ(expected.num_channels(), data.num_channels());
+  ASSERT_EQ(0, data.motion().num_frames());
+  ASSERT_EQ(expected.joints().size(), data.joints().size());
+
+  for (unsigned j = 0; j < data.joints().size(); j++) {
+    ASSERT_EQ(expected.joints()[j]->name(), data.joints()[j]->name());
+    ASSERT_EQ(expected.joints()[j]->offset().x, data.joints()[j]->offset().x);
+    ASSERT_TRUE(expected.joints()[j]->channels_order() ==
+        data.joints()[j]->channels_order());
+  }
+
+  // There is no motion data to calculate transforms from
+  data.recalculate_joints_ltm();
+  for (unsigned j = 0; j < data.joints().size(); j++)
+    ASSERT_TRUE(data.joints()[j]->ltm().empty());
+  std::vector<glm::mat4> pose(data.joints().size());
+  ASSERT_EQ(-1, data.calculate_pose(0, pose.data()));
+}
+
+TEST(ExampleFileTest, ConcurrentParseTest) {
+  bvh::Bvh_parser parser;
+  bvh::Bvh expected;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh";
+  ASSERT_EQ(0, parser.parse(sample_path, &expected));
+
+  // One parser shared by all threads
+  parser.set_load_mode(bvh::Bvh_parser::Load_mode::LAZY);
+  const bvh::Bvh_parser& shared = parser;
+  const unsigned kThreads = 4;
+  std::vector<bvh::Bvh> parsed(kThreads);
+  std::vector<int> results(kThreads, -1);
+  std::vector<std::thread> threads;
+
+  for (unsigned i = 0; i < kThreads; i++) {
+    threads.emplace_back([&, i]() {
+      results[i] = shared.parse(sample_path, &parsed[i]);
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+
+  // Lazy frames of one const bvh decoded by all threads at once
+  const bvh::Bvh& data = parsed[0];
+  std::vector<std::vector<glm::mat4>> poses(kThreads,
+      std::vector<glm::mat4>(data.joints().size()));
+  threads.clear();
+  for (unsigned i = 0; i < kThreads; i++) {
+    threads.emplace_back([&, i]() {
+      data.calculate_pose(data.num_frames() - 1, poses[i].data());
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+
+  std::vector<glm::mat4> expected_pose(expected.joints().size());
+  expected.calculate_pose(expected.num_frames() - 1, expected_pose.data());
+
+  for (unsigned i = 0; i < kThreads; i++) {
+    ASSERT_EQ(0, results[i]);
+    ASSERT_EQ(expected.motion().data().to_vector(),
+        parsed[i].motion().data().to_vector());
+    ASSERT_EQ(expected_pose, poses[i]);
+  }
+}
+
+TEST(ExampleFileTest, BinaryRoundTripTest) {
+  bvh::Bvh_parser parser;
+  bf::path directory = bf::temp_directory_path() / bf::unique_path();
+  bf::create_directories(directory);
+
+  for (const char* name : {"example.bvh", "simple.bvh", "walk_01.bvh"}) {
+    bvh::Bvh expected;
+    ASSERT_EQ(0, parser.parse(bf::path(TEST_BVH_FILES_PATH) / name,
+        &expected));
+
+    bf::path binary_path = directory / (std::string(name) + "b");
+    ASSERT_EQ(0, bvh::save_binary(expected, binary_path));
+
+    bvh::Bvh data;
+    ASSERT_EQ(0, bvh::load_binary(binary_path, &data));
+
+    ASSERT_EQ(expected.num_frames(), data.num_frames());
+    ASSERT_EQ(expected.frame_time(), data.frame_time());
+    ASSERT_EQ(expected.num_channels(), data.num_channels());
+    ASSERT_EQ(expected.joints().size(), data.joints().size());
+    ASSERT_EQ(expected.joints()[0], expected.root_joint());
+    ASSERT_EQ(data.joints()[0], data.root_joint());
+
+    for (unsigned j = 0; j < data.joints().size(); j++) {
+      const bvh::Joint& expected_joint = *expected.joints()[j];
+      const bvh::Joint& joint = *data.joints()[j];
+      ASSERT_EQ(expected_joint.name(), joint.name());
+      ASSERT_EQ(expected_joint.offset().x, joint.offset().x);
+      ASSERT_EQ(expected_joint.offset().y, joint.offset().y);
+      ASSERT_EQ(expected_joint.offset().z, joint.offset().z);
+      ASSERT_TRUE(expected_joint.channels_order() == joint.channels_order());
+      ASSERT_EQ(expected_joint.children().size(), joint.children().size());
+      ASSERT_EQ(expected.skeleton().parent(j), data.skeleton().parent(j));
+    }
+
+    ASSERT_EQ(expected.motion().data().to_vector(),
+        data.motion().data().to_vector());
+
+    expected.recalculate_joints_ltm();
+    data.recalculate_joints_ltm();
+    for (unsigned j = 0; j < data.joints().size(); j++)
+      ASSERT_EQ(expected.joints()[j]->ltm(), data.joints()[j]->ltm());
+
+    // Changes of loaded motion matrix are not written to file
+    data.motion().frame(0)[0] += 1.0f;
+    bvh::Bvh reloaded;
+    ASSERT_EQ(0, bvh::load_binary(binary_path, &reloaded));
+    ASSERT_EQ(expected.motion().frame(0)[0], reloaded.motion().frame(0)[0]);
+  }
+
+  bf::remove_all(directory);
+}
+
+TEST(ExampleFileTest, CachedParseTest) {
+  bvh::Bvh_parser parser;
+  bvh::Bvh expected;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh";
+  ASSERT_EQ(0, parser.parse(sample_path, &expected));
+
+  bf::path directory = bf::temp_directory_path() / bf::unique_path();
+  bf::path cache_directory = directory / "cache";
+  bf::create_directories(directory);
+  bf::path path = directory / "walk_01.bvh";
+  bf::copy_file(sample_path, path);
+
+  parser.set_cache_directory(cache_directory);
+
+  bvh::Bvh parsed;
+  ASSERT_EQ(0, parser.parse(path, &parsed));
+  ASSERT_EQ(1, std::distance(bf::directory_iterator(cache_directory),
+      bf::directory_iterator()));
+  bf::path snapshot = bf::directory_iterator(cache_directory)->path();
+
+  // Snapshot of other file found under the same name is not used
+  bvh::Bvh simple;
+  bf::path simple_path = directory / "simple.bvh";
+  bf::copy_file(bf::path(TEST_BVH_FILES_PATH) / "simple.bvh", simple_path);
+  ASSERT_EQ(0, parser.parse(simple_path, &simple));
+  for (bf::directory_iterator it(cache_directory), end; it != end; ++it) {
+    if (it->path() != snapshot)
+      bf::copy_file(snapshot, it->path(), bf::copy_option::overwrite_if_exists);
+  }
+
+  bvh::Bvh collided;
+  ASSERT_EQ(0, parser.parse(simple_path, &collided));
+  ASSERT_EQ(simple.joints().size(), collided.joints().size());
+  ASSERT_EQ(simple.motion().data().to_vector(),
+      collided.motion().data().to_vector());
+  bvh::Bvh wrong_key;
+  ASSERT_EQ(-1, bvh::load_binary(snapshot, &wrong_key, "other"));
+  ASSERT_TRUE(wrong_key.joints().empty());
+
+  // File of the same size and time is not parsed again
+  std::time_t time = bf::last_write_time(path);
+  {
+    bf::ofstream file(path, std::ios_base::in | std::ios_base::out);
+    file << "broken";
+  }
+  bf::last_write_time(path, time);
+
+  bvh::Bvh cached;
+  ASSERT_EQ(0, parser.parse(path, &cached));
+  ASSERT_EQ(expected.joints().size(), cached.joints().size());
+  ASSERT_EQ(expected.motion().data().to_vector(),
+      cached.motion().data().to_vector());
+
+  // Changed file is parsed
+  bf::last_write_time(path, time + 10);
+  bvh::Bvh changed;
+  ASSERT_EQ(-1, parser.parse(path, &changed));
+
+  bf::remove_all(directory);
+}
+
+TEST(ExampleFileTest, InMemoryParseTest) {
+  bvh::Bvh_parser parser;
+  bvh::Bvh expected;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh";
+  ASSERT_EQ(0, parser.parse(sample_path, &expected));
+
+  bf::ifstream file(sample_path, std::ios_base::in | std::ios_base::binary);
+  std::string content((std::istreambuf_iterator<char>(file)),
+      std::istreambuf_iterator<char>());
+
+  bvh::Bvh from_buffer;
+  ASSERT_EQ(0, parser.parse_buffer(content, &from_buffer));
+  ASSERT_EQ(expected.motion().data().to_vector(),
+      from_buffer.motion().data().to_vector());
+
+  std::istringstream stream(content);
+  bvh::Bvh from_stream;
+  ASSERT_EQ(0, parser.parse(stream, &from_stream));
+  ASSERT_EQ(expected.motion().data().to_vector(),
+      from_stream.motion().data().to_vector());
+
+  // Lazy motion matrix parses frames from its own copy of buffer
+  parser.set_load_mode(bvh::Bvh_parser::Load_mode::LAZY);
+  bvh::Bvh lazy;
+  {
+    std::string copy = content;
+    ASSERT_EQ(0, parser.parse_buffer(copy, &lazy));
+    std::fill(copy.begin(), copy.end(), '\0');
+  }
+  ASSERT_TRUE(lazy.motion().lazy());
+  ASSERT_EQ(expected.motion().data().to_vector(),
+      lazy.motion().data().to_vector());
+
+  bvh::Bvh truncated;
+  ASSERT_EQ(-1, parser.parse_buffer(boost::string_view(content.data(),
+      content.size() / 2), &truncated));
+}
+
+TEST(ExampleFileTest, BatchParseTest) {
+  bvh::Bvh_parser parser;
+  bvh::Bvh expected;
+  bf::path sample_path = bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh";
+  ASSERT_EQ(0, parser.parse(sample_path, &expected));
+
+  bf::path directory = bf::temp_directory_path() / bf::unique_path();
+  bf::create_directories(directory);
+  for (int i = 0; i < 8; i++) {
+    bf::copy_file(sample_path, directory / ("walk_" + std::to_string(i) +
+        ".bvh"));
+  }
+  bf::ofstream(directory / "broken.bvh") << "HIERARCHY\nROOT Hips\n";
+  bf::ofstream(directory / "notes.txt") << "not bvh";
+
+  std::vector<bf::path> paths;
+  std::vector<bvh::Bvh> bvhs;
+  std::vector<int> errors;
+  ASSERT_EQ(-1, parser.parse_batch(directory, "*.bvh", paths, bvhs, errors));
+  ASSERT_EQ(9, paths.size());
+  ASSERT_EQ(9, bvhs.size());
+  ASSERT_EQ(directory / "broken.bvh", paths[0]);
+  ASSERT_EQ(-1, errors[0]);
+
+  // Frames of files are parsed in parallel inside of parallel batch
+  parser.set_thread_pool(std::make_shared<bvh::Thread_pool>(4));
+  paths.erase(paths.begin());
+  paths.push_back(directory / "missing.bvh");
+  ASSERT_EQ(-1, parser.parse_batch(paths, bvhs, errors));
+  ASSERT_EQ(9, errors.size());
+  ASSERT_EQ(bvh::Bvh_parser::kCannotOpen, errors[8]);
+
+  for (unsigned i = 0; i < 8; i++) {
+    ASSERT_EQ(0, errors[i]);
+    ASSERT_EQ(expected.motion().data().to_vector(),
+        bvhs[i].motion().data().to_vector());
+  }
+
+  bf::remove_all(directory);
+}
+
+TEST(ClipCacheTest, SharedClipsTest) {
+  bf::path directory = bf::temp_directory_path() / bf::unique_path();
+  bf::create_directories(directory);
+  bf::path first_path = directory / "first.bvh";
+  bf::path second_path = directory / "second.bvh";
+  bf::copy_file(bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh", first_path);
+  bf::copy_file(bf::path(TEST_BVH_FILES_PATH) / "walk_01.bvh", second_path);
+
+  std::atomic<unsigned> loads(0);
+  bvh::Clip_cache::Loader loader = [&](const bf::path& path, bvh::Bvh* bvh) {
+    loads++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    return bvh::Bvh_parser().parse(path, bvh);
+  };
+
+  // Concurrent requests of the same clip load it once
+  bvh::Clip_cache cache(1 << 30, loader);
+  std::vector<std::shared_ptr<const bvh::Bvh>> clips(4);
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < clips.size(); i++)
+    threads.emplace_back([&, i]() { cache.get(first_path, clips[i]); });
+  for (std::thread& thread : threads)
+    thread.join();
+
+  ASSERT_EQ(1, loads);
+  ASSERT_TRUE(clips[0] != nullptr);
+  for (const std::shared_ptr<const bvh::Bvh>& clip : clips)
+    ASSERT_EQ(clips[0], clip);
+  ASSERT_EQ(clips[0]->memory_size(), cache.memory_size());
+
+  std::shared_ptr<const bvh::Bvh> clip;
+  ASSERT_EQ(0, cache.get(directory / "." / "first.bvh", clip));
+  ASSERT_EQ(clips[0], clip);
+  ASSERT_EQ(1, loads);
+
+  // Changed file is loaded again
+  bf::last_write_time(first_path, bf::last_write_time(first_path) + 10);
+  ASSERT_EQ(0, cache.get(first_path, clip));
+  ASSERT_NE(clips[0], clip);
+  ASSERT_EQ(2, loads);
+  ASSERT_EQ(1, cache.num_clips());
+
+  // Budget for one clip keeps only the most recently used one
+  bvh::Clip_cache small_cache(clip->memory_size() * 3 / 2, loader);
+  ASSERT_EQ(0, small_cache.get(first_path, clip));
+  ASSERT_EQ(0, small_cache.get(second_path, clip));
+  ASSERT_EQ(1, small_cache.num_clips());
+  ASSERT_EQ(4, loads);
+  ASSERT_EQ(0, small_cache.get(second_path, clip));
+  ASSERT_EQ(4, loads);
+  ASSERT_EQ(0, small_cache.get(first_path, clip));
+  ASSERT_EQ(5, loads);
+
+  ASSERT_EQ(-1, small_cache.get(directory / "missing.bvh", clip));
+  small_cache.clear();
+  ASSERT_EQ(0, small_cache.num_clips());
+  ASSERT_EQ(0, small_cache.memory_size());
+
+  // Throwing loader fails every waiting thread and leaves no entry
+  bool fail = true;
+  bvh::Clip_cache throwing_cache(1 << 30, [&](const bf::path& path,
+      bvh::Bvh* bvh) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    if (fail)
+      throw std::runtime_error("loader failure");
+    return bvh::Bvh_parser().parse(path, bvh);
+  });
+  std::vector<int> results(clips.size());
+  threads.clear();
+  for (unsigned i = 0; i < clips.size(); i++) {
+    threads.emplace_back([&, i]() {
+      results[i] = throwing_cache.get(first_path, clips[i]);
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+
+  for (int result : results)
+    ASSERT_EQ(-1, result);
+  ASSERT_EQ(0, throwing_cache.num_clips());
+  fail = false;
+  ASSERT_EQ(0, throwing_cache.get(first_path, clip));
+
+  bf::remove_all(directory);
+}